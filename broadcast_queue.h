@@ -0,0 +1,201 @@
+/**
+ * @author Hanwen Zheng
+ * @email eserinc.z@outlook.com
+ * @create date 2026-10-18 16:20:52
+ * @modify date 2026-10-18 16:20:52
+ * @desc A limited size concurrent queue delivering every element to each of
+ * several consumer groups, using std::mutex and std::condition_variable.
+ */
+#pragma once
+#include <cassert>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace fox_cq {
+
+// A limited size queue where each consumer group sees every element, while
+// consumers within one group share its elements like `ConcurrentQueue`.
+// Elements live in one circular buffer. Each group has a cursor into it, and a
+// slot is reclaimed once the slowest group has passed it, so producers wait
+// while the slowest group is `MaxSize` elements behind.
+template <typename T, std::size_t MaxSize>
+class BroadcastQueue {
+  static_assert(MaxSize > 0, "MaxSize should be positive");
+
+ public:
+  BroadcastQueue() : slots_(MaxSize), head_(0), tail_(0) {}
+  BroadcastQueue(const BroadcastQueue&) = delete;
+  BroadcastQueue& operator=(const BroadcastQueue&) = delete;
+
+  ~BroadcastQueue() {
+    SetFinish();
+    for (std::uint64_t seq = head_; seq != tail_; seq++) {
+      At(seq)->~T();
+    }
+  }
+
+  // Add a consumer group receiving every element pushed from now on.
+  // Return the id of the group to pop with.
+  // Elements pushed while there is no group are discarded.
+  std::size_t AddConsumerGroup() {
+    std::lock_guard<std::mutex> guard{lock_};
+    cursors_.push_back(tail_);
+    empty_conds_.emplace_back(new std::condition_variable());
+    return cursors_.size() - 1;
+  }
+
+  // Mark the queue has no more `Push` operation.
+  // `Push` operation after `SetFinish` will be ignored.
+  // Notice that `Pop` operation still works for remaining elements in the
+  // queue.
+  void SetFinish() {
+    {
+      std::lock_guard<std::mutex> guard{lock_};
+      finished_ = true;
+    }
+    WakeupAll();
+  }
+
+  // Move and push `item` into back of the queue, will wait for the slowest
+  // group to make space. (blocking, may wait other thread to pop)
+  void Push(T&& item) { PushImpl(std::move(item)); }
+
+  // Copy and push `item` into back of the queue, will wait for the slowest
+  // group to make space. (blocking, may wait other thread to pop)
+  void Push(const T& item) { PushImpl(item); }
+
+  // Copy the next element of `group` to `result`. (non-blocking, return
+  // immediately)
+  // Return true on success.
+  // Return false on failure (no element left for the group).
+  bool TryPop(std::size_t group, T& result) {
+    std::unique_lock<std::mutex> lk{lock_};
+    assert(group < cursors_.size());
+    if (cursors_[group] == tail_) {
+      return false;
+    }
+    PopFor(group, result);
+    return true;
+  }
+
+  // Copy the next element of `group` to `result`, will wait for element to
+  // push. (blocking, may wait other thread to push new element)
+  // Return true on success.
+  // Return false on failure (no element left for the group of a finished
+  // queue).
+  bool Pop(std::size_t group, T& result) {
+    std::unique_lock<std::mutex> lk{lock_};
+    assert(group < cursors_.size());
+    empty_conds_[group]->wait(
+        lk, [this, group] { return cursors_[group] != tail_ || finished_; });
+    if (cursors_[group] != tail_) {
+      PopFor(group, result);
+      if (cursors_[group] != tail_) {
+        empty_conds_[group]->notify_one();
+      }
+      return true;
+    }
+
+    assert(finished_);
+    // finished, should notify other threads to stop waiting.
+    empty_conds_[group]->notify_all();
+    return false;
+  }
+
+  // Return number of elements `group` has not popped yet.
+  std::size_t Size(std::size_t group) const {
+    std::lock_guard<std::mutex> guard{lock_};
+    assert(group < cursors_.size());
+    return static_cast<std::size_t>(tail_ - cursors_[group]);
+  }
+
+  // Return number of elements kept for the slowest group.
+  std::size_t Size() const {
+    std::lock_guard<std::mutex> guard{lock_};
+    return static_cast<std::size_t>(tail_ - head_);
+  }
+
+ private:
+  struct Slot {
+    alignas(T) unsigned char data[sizeof(T)];
+  };
+
+  T* At(std::uint64_t seq) {
+    return reinterpret_cast<T*>(slots_[seq % MaxSize].data);
+  }
+
+  void WakeupAll() const {
+    std::lock_guard<std::mutex> guard{lock_};
+    for (const auto& cond : empty_conds_) {
+      cond->notify_all();
+    }
+    full_cond_.notify_all();
+  }
+
+  template <typename U>
+  void PushImpl(U&& item) {
+    std::unique_lock<std::mutex> lk{lock_};
+    full_cond_.wait(lk,
+                    [this] { return tail_ - head_ < MaxSize || finished_; });
+    if (finished_) {
+      lk.unlock();
+      // finished, should notify other threads to stop waiting.
+      WakeupAll();
+      return;
+    }
+    if (cursors_.empty()) {
+      // No one would ever pop it.
+      return;
+    }
+    new (At(tail_)) T(std::forward<U>(item));
+    ++tail_;
+    if (tail_ - head_ < MaxSize) {
+      full_cond_.notify_one();
+    }
+    for (const auto& cond : empty_conds_) {
+      cond->notify_one();
+    }
+  }
+
+  void PopFor(std::size_t group, T& result) {
+    std::uint64_t seq = cursors_[group]++;
+    result = *At(seq);
+    if (seq == head_) {
+      Reclaim();
+    }
+  }
+
+  // Destroy elements every group has passed.
+  void Reclaim() {
+    std::uint64_t min_cursor = tail_;
+    for (std::uint64_t cursor : cursors_) {
+      if (cursor < min_cursor) min_cursor = cursor;
+    }
+    if (min_cursor == head_) {
+      return;
+    }
+    for (; head_ != min_cursor; head_++) {
+      At(head_)->~T();
+    }
+    full_cond_.notify_all();
+  }
+
+  mutable std::mutex lock_;
+  mutable std::vector<std::unique_ptr<std::condition_variable>> empty_conds_;
+  mutable std::condition_variable full_cond_;
+  std::vector<Slot> slots_;
+  // Sequence number of the next element each group pops.
+  std::vector<std::uint64_t> cursors_;
+  // Sequence number of the oldest element kept.
+  std::uint64_t head_;
+  // Sequence number of the next element pushed.
+  std::uint64_t tail_;
+  bool finished_ = false;
+};
+
+}  // namespace fox_cq
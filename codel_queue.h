@@ -0,0 +1,158 @@
+/**
+ * @author Hanwen Zheng
+ * @email eserinc.z@outlook.com
+ * @create date 2026-10-18 21:14:52
+ * @modify date 2026-10-18 21:14:52
+ * @desc An unlimited size concurrent queue keeping latency bounded under
+ * overload by dropping elements with the CoDel control law.
+ */
+#pragma once
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <utility>
+
+#include "concurrent_queue.h"
+
+namespace fox_cq {
+
+template <typename T>
+struct CoDelOptions {
+  // Acceptable minimum time elements stay in the queue.
+  std::chrono::steady_clock::duration target = std::chrono::milliseconds(5);
+  // How long the sojourn time may stay above `target` before dropping starts,
+  // about the time consumers need to catch up with a burst.
+  std::chrono::steady_clock::duration interval =
+      std::chrono::milliseconds(100);
+  // Called with each dropped element, e.g. to divert it to a slower path.
+  // It runs with the lock of the queue held and should not use the queue.
+  std::function<void(T&&)> on_drop;
+};
+
+// A container for `ConcurrentQueue` stamping each element with its push time
+// and applying CoDel (RFC 8289) at pop: once the sojourn time of popped
+// elements has stayed above `target` for `interval`, elements are dropped at
+// the front, at a rate growing with the square root of the number of drops
+// until the sojourn time falls below `target` again. The last element in the
+// queue is never dropped.
+// T should be default constructible.
+template <typename T>
+class CoDelContainer {
+  using Clock = std::chrono::steady_clock;
+
+ public:
+  explicit CoDelContainer(CoDelOptions<T> options = CoDelOptions<T>())
+      : options_(std::move(options)),
+        first_above_time_(),
+        drop_next_(),
+        count_(0),
+        last_count_(0),
+        dropping_(false) {}
+
+  template <typename U>
+  void Push(U&& value) {
+    data_.push_back(Entry{std::forward<U>(value), Clock::now()});
+  }
+
+  void Push() { data_.push_back(Entry{T(), Clock::now()}); }
+
+  void Pop(T& value) { value = std::move(Dequeue()); }
+
+  void Pop() { Dequeue(); }
+
+  std::size_t Size() const { return data_.size(); }
+
+  bool Empty() const { return data_.empty(); }
+
+  bool Full() const { return false; }
+
+ private:
+  struct Entry {
+    T item;
+    Clock::time_point enqueued;
+  };
+
+  // Take out the front entry into `front_`, return true iff it may be
+  // dropped.
+  bool DoDequeue(Clock::time_point now) {
+    assert(!data_.empty());
+    front_ = std::move(data_.front().item);
+    Clock::duration sojourn = now - data_.front().enqueued;
+    data_.pop_front();
+    if (sojourn < options_.target || data_.empty()) {
+      // Below target, or the last element which is never dropped.
+      first_above_time_ = Clock::time_point();
+      return false;
+    }
+    if (first_above_time_ == Clock::time_point()) {
+      first_above_time_ = now + options_.interval;
+      return false;
+    }
+    return now >= first_above_time_;
+  }
+
+  void Drop() {
+    if (options_.on_drop) {
+      options_.on_drop(std::move(front_));
+    }
+  }
+
+  Clock::time_point ControlLaw(Clock::time_point t) const {
+    return t + std::chrono::duration_cast<Clock::duration>(
+                   options_.interval / std::sqrt(static_cast<double>(count_)));
+  }
+
+  T& Dequeue() {
+    Clock::time_point now = Clock::now();
+    bool ok_to_drop = DoDequeue(now);
+    if (dropping_) {
+      if (!ok_to_drop) {
+        dropping_ = false;
+      }
+      while (dropping_ && now >= drop_next_) {
+        Drop();
+        ++count_;
+        if (!DoDequeue(now)) {
+          dropping_ = false;
+        } else {
+          drop_next_ = ControlLaw(drop_next_);
+        }
+      }
+    } else if (ok_to_drop) {
+      Drop();
+      DoDequeue(now);
+      dropping_ = true;
+      // Resume near the last drop rate if dropping stopped recently.
+      std::uint64_t delta = count_ - last_count_;
+      count_ = delta > 1 && now - drop_next_ < 16 * options_.interval ? delta
+                                                                      : 1;
+      drop_next_ = ControlLaw(now);
+      last_count_ = count_;
+    }
+    return front_;
+  }
+
+  CoDelOptions<T> options_;
+  std::deque<Entry> data_;
+  // The element being popped.
+  T front_;
+  // When the sojourn time has been above target for an interval, or zero if
+  // it is below target.
+  Clock::time_point first_above_time_;
+  Clock::time_point drop_next_;
+  // Number of drops since entering the dropping state.
+  std::uint64_t count_;
+  std::uint64_t last_count_;
+  bool dropping_;
+};
+
+// An unlimited size queue dropping elements with CoDel, constructed with
+// `CoDelConcurrentQueue<T> q(CoDelContainer<T>(options))`.
+template <typename T>
+using CoDelConcurrentQueue =
+    ConcurrentQueue<T, ConcurrentQueueUnlimitedSize, CoDelContainer<T>>;
+
+}  // namespace fox_cq
@@ -0,0 +1,321 @@
+/**
+ * @author Hanwen Zheng
+ * @email eserinc.z@outlook.com
+ * @create date 2026-10-18 10:02:41
+ * @modify date 2026-10-18 10:02:41
+ * @desc A concurrent queue of variable length byte records stored inline in one
+ * contiguous circular buffer, using std::mutex and std::condition_variable.
+ */
+#pragma once
+#include <cassert>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+namespace fox_cq {
+
+// A limited size queue of byte records. Each record is stored with a length
+// prefix in a circular buffer of `Capacity` bytes, so pushing and popping do
+// not allocate.
+// Popped records are handed out as views into the buffer. The space of a
+// record is given back to producers when its view is released, so views should
+// be released as soon as the record has been consumed.
+template <std::size_t Capacity>
+class ConcurrentByteQueue {
+  static_assert(Capacity % 8 == 0 && Capacity >= 16,
+                "Capacity should be a multiple of 8 and at least 16");
+
+ public:
+  // A popped record. It refers to memory inside the queue and gives it back
+  // to the queue on destruction or `Release`.
+  class ByteView {
+   public:
+    ByteView() : queue_(nullptr), data_(nullptr), size_(0), offset_(0) {}
+    ByteView(const ByteView&) = delete;
+    ByteView(ByteView&& other)
+        : queue_(other.queue_),
+          data_(other.data_),
+          size_(other.size_),
+          offset_(other.offset_) {
+      other.queue_ = nullptr;
+    }
+    ByteView& operator=(const ByteView&) = delete;
+    ByteView& operator=(ByteView&& other) {
+      if (this != &other) {
+        Release();
+        queue_ = other.queue_;
+        data_ = other.data_;
+        size_ = other.size_;
+        offset_ = other.offset_;
+        other.queue_ = nullptr;
+      }
+      return *this;
+    }
+    ~ByteView() { Release(); }
+
+    const unsigned char* Data() const { return data_; }
+
+    std::size_t Size() const { return size_; }
+
+    // Return true iff this view refers to a record.
+    bool Valid() const { return queue_ != nullptr; }
+
+    // Give the memory of the record back to the queue.
+    void Release() {
+      if (queue_) {
+        queue_->ReleaseRecord(offset_);
+        queue_ = nullptr;
+        data_ = nullptr;
+        size_ = 0;
+      }
+    }
+
+   private:
+    friend class ConcurrentByteQueue;
+
+    ConcurrentByteQueue* queue_;
+    const unsigned char* data_;
+    std::size_t size_;
+    std::size_t offset_;
+  };
+
+  ConcurrentByteQueue()
+      : buffer_(Capacity), head_(0), read_(0), tail_(0), used_(0), size_(0) {}
+  // Views point into the buffer, so the queue is neither copyable nor movable.
+  ConcurrentByteQueue(const ConcurrentByteQueue&) = delete;
+  ConcurrentByteQueue& operator=(const ConcurrentByteQueue&) = delete;
+
+  // All views should be released before the queue is destructed.
+  ~ConcurrentByteQueue() { SetFinish(); }
+
+  // Mark the queue has no more `PushBytes` operation.
+  // `PushBytes` operation after `SetFinish` will be ignored.
+  // Notice that `PopBytes` operation still works for remaining records in the
+  // queue.
+  void SetFinish() {
+    {
+      std::lock_guard<std::mutex> guard{lock_};
+      finished_ = true;
+    }
+    WakeupAll();
+  }
+
+  // Copy `len` bytes from `data` into back of the queue as one record, will
+  // wait for space. (blocking, may wait other thread to release records)
+  // Return true on success.
+  // Return false if the queue is finished or the record can never fit into
+  // the buffer.
+  bool PushBytes(const void* data, std::size_t len) {
+    std::size_t need = RecordSize(len);
+    if (len > UINT32_MAX || need > Capacity) {
+      return false;
+    }
+    std::unique_lock<std::mutex> lk{lock_};
+    full_cond_.wait(lk, [this, need] { return Fits(need) || finished_; });
+    if (finished_) {
+      // finished, should notify other threads to stop waiting.
+      WakeupAll();
+      return false;
+    }
+    if (Capacity - tail_ < need) {
+      // Not enough room before the end of the buffer, skip to the beginning.
+      WriteHeader(tail_, 0, kWrap);
+      used_ += Capacity - tail_;
+      tail_ = 0;
+    }
+    WriteHeader(tail_, static_cast<std::uint32_t>(len), kReady);
+    if (len > 0) {
+      std::memcpy(&buffer_[tail_ + kHeaderSize], data, len);
+    }
+    tail_ += need;
+    if (tail_ == Capacity) {
+      tail_ = 0;
+    }
+    used_ += need;
+    ++size_;
+    empty_cond_.notify_one();
+    return true;
+  }
+
+  // Pop out the front record to `view`. (non-blocking, return immediately)
+  // Return true on success.
+  // Return false on failure (trying to
+  // pop from an empty queue).
+  bool TryPopBytes(ByteView& view) {
+    view.Release();
+    std::unique_lock<std::mutex> lk{lock_};
+    if (size_ == 0) {
+      return false;
+    }
+    PopRecord(view);
+    return true;
+  }
+
+  // Pop out the front record to `view`, will wait for record to push.
+  // (blocking, may wait other thread to push new record)
+  // Return true on success.
+  // Return false on failure (trying to
+  // pop from a finished and empty queue).
+  bool PopBytes(ByteView& view) {
+    view.Release();
+    std::unique_lock<std::mutex> lk{lock_};
+    empty_cond_.wait(lk, [this] { return size_ > 0 || finished_; });
+    if (size_ > 0) {
+      PopRecord(view);
+      if (size_ > 0) {
+        empty_cond_.notify_one();
+      } else if (finished_) {
+        // finished, should notify other threads to stop waiting.
+        WakeupAll();
+      }
+      return true;
+    }
+
+    assert(finished_);
+    // finished, should notify other threads to stop waiting.
+    WakeupAll();
+    return false;
+  }
+
+  // Return number of records waiting to be popped.
+  std::size_t Size() const {
+    std::lock_guard<std::mutex> guard{lock_};
+    return size_;
+  }
+
+  // Return number of bytes in use, including records held by views.
+  std::size_t UsedBytes() const {
+    std::lock_guard<std::mutex> guard{lock_};
+    return used_;
+  }
+
+ private:
+  // Every record starts with a header and is padded to keep headers aligned.
+  struct RecordHeader {
+    std::uint32_t size;
+    std::uint32_t state;
+  };
+  static const std::size_t kHeaderSize = sizeof(RecordHeader);
+  // Padding up to the end of the buffer, the next record is at the beginning.
+  static const std::uint32_t kWrap = 0;
+  // Pushed but not popped yet.
+  static const std::uint32_t kReady = 1;
+  // Popped and held by a view.
+  static const std::uint32_t kClaimed = 2;
+  // Released by its view, waiting for the records before it to be released.
+  static const std::uint32_t kReleased = 3;
+
+  static std::size_t RecordSize(std::size_t len) {
+    return (kHeaderSize + len + 7) & ~static_cast<std::size_t>(7);
+  }
+
+  void WakeupAll() const {
+    empty_cond_.notify_all();
+    full_cond_.notify_all();
+  }
+
+  RecordHeader ReadHeader(std::size_t offset) const {
+    RecordHeader header;
+    std::memcpy(&header, &buffer_[offset], kHeaderSize);
+    return header;
+  }
+
+  void WriteHeader(std::size_t offset, std::uint32_t size,
+                   std::uint32_t state) {
+    RecordHeader header{size, state};
+    std::memcpy(&buffer_[offset], &header, kHeaderSize);
+  }
+
+  void SetState(std::size_t offset, std::uint32_t state) {
+    std::memcpy(&buffer_[offset + offsetof(RecordHeader, state)], &state,
+                sizeof(state));
+  }
+
+  // Return true iff a record of `need` bytes can be written now.
+  bool Fits(std::size_t need) {
+    if (used_ == 0) {
+      // Nothing is held by anyone, restart from the beginning so the whole
+      // buffer is contiguous.
+      head_ = read_ = tail_ = 0;
+      return true;
+    }
+    if (tail_ > head_) {
+      // Free space is [tail_, Capacity) and [0, head_).
+      return Capacity - tail_ >= need || head_ >= need;
+    }
+    // Free space is [tail_, head_).
+    return head_ - tail_ >= need;
+  }
+
+  void PopRecord(ByteView& view) {
+    RecordHeader header = ReadHeader(read_);
+    if (header.state == kWrap) {
+      read_ = 0;
+      header = ReadHeader(read_);
+    }
+    assert(header.state == kReady);
+    SetState(read_, kClaimed);
+    view.queue_ = this;
+    view.data_ = &buffer_[read_ + kHeaderSize];
+    view.size_ = header.size;
+    view.offset_ = read_;
+    read_ += RecordSize(header.size);
+    if (read_ == Capacity) {
+      read_ = 0;
+    }
+    --size_;
+  }
+
+  void ReleaseRecord(std::size_t offset) {
+    std::lock_guard<std::mutex> guard{lock_};
+    SetState(offset, kReleased);
+    std::size_t used = used_;
+    // Reclaim every released record at the front.
+    while (used_ > 0) {
+      RecordHeader header = ReadHeader(head_);
+      if (header.state == kWrap) {
+        // The padding is about to be overwritten, move a reader still in
+        // front of it to the record after it.
+        if (read_ == head_) {
+          read_ = 0;
+        }
+        used_ -= Capacity - head_;
+        head_ = 0;
+      } else if (header.state == kReleased) {
+        std::size_t size = RecordSize(header.size);
+        used_ -= size;
+        head_ += size;
+        if (head_ == Capacity) {
+          head_ = 0;
+        }
+      } else {
+        break;
+      }
+    }
+    if (used_ != used) {
+      // Records have different sizes, every producer may fit now.
+      full_cond_.notify_all();
+    }
+  }
+
+  mutable std::mutex lock_;
+  mutable std::condition_variable empty_cond_;
+  mutable std::condition_variable full_cond_;
+  std::vector<unsigned char> buffer_;
+  // Offset of the oldest record not released.
+  std::size_t head_;
+  // Offset of the oldest record not popped.
+  std::size_t read_;
+  // Offset to write the next record.
+  std::size_t tail_;
+  // Number of bytes in use, including padding.
+  std::size_t used_;
+  // Number of records not popped.
+  std::size_t size_;
+  bool finished_ = false;
+};
+
+}  // namespace fox_cq
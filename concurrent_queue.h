@@ -7,20 +7,106 @@
  * consumer using std::mutex and std::condition_variable.
  */
 #pragma once
+#include <atomic>
 #include <cassert>
 #include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
 #include <mutex>
+#include <new>
 #include <queue>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <unistd.h>
+#define FOX_CQ_HAS_EVENTFD 1
+#endif
+
+// `AsyncPop` and `AsyncPush` are available when compiled with C++20
+// coroutines.
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#include <coroutine>
+#include <tuple>
+#define FOX_CQ_HAS_COROUTINE 1
+#endif
+#endif
+
+// Static tracepoints for bpftrace, perf or SystemTap, e.g.
+// `usdt:./a.out:fox_cq:wait__begin`. Enabled by defining `FOX_CQ_ENABLE_USDT`,
+// which requires <sys/sdt.h>, they compile to nothing otherwise.
+// Each probe passes the queue and a value:
+// - `wait__begin`, `wait__end`: 0 for `Pop` waiting for an element, 1 for
+//   `Push` waiting for a free slot.
+// - `push`, `pop`, `finish`: number of elements in the queue afterwards,
+//   including the sub-queues of producer tokens. Bulk operations and
+//   reservations fire once per chunk. A token `Push` does not take the lock
+//   of the queue, so it passes the number of elements in the sub-queues only.
+#ifdef FOX_CQ_ENABLE_USDT
+#if !defined(__has_include)
+#error "FOX_CQ_ENABLE_USDT requires __has_include to find <sys/sdt.h>"
+#elif __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define FOX_CQ_HAS_USDT 1
+#else
+#error "FOX_CQ_ENABLE_USDT requires <sys/sdt.h>, e.g. from systemtap-sdt-dev"
+#endif
+#endif
+
+#ifdef FOX_CQ_HAS_USDT
+#define FOX_CQ_PROBE(name, queue, value) \
+  DTRACE_PROBE2(fox_cq, name, queue, value)
+#else
+#define FOX_CQ_PROBE(name, queue, value) \
+  do {                                   \
+  } while (0)
+#endif
+
 namespace fox_cq {
 
 static const std::size_t ConcurrentQueueUnlimitedSize =
     static_cast<std::size_t>(-1);
 
+// A contiguous run of slots inside the circular buffer of a limited size
+// queue.
+template <typename T>
+struct ConcurrentQueueSpan {
+  T* data;
+  std::size_t size;
+};
+
+// Writable slots handed out by `ConcurrentQueue::Reserve`. Because the buffer
+// is circular, the reserved slots may wrap around and be split into two
+// spans; `second` is empty otherwise.
+template <typename T>
+struct ConcurrentQueueReservation {
+  ConcurrentQueueSpan<T> first;
+  ConcurrentQueueSpan<T> second;
+
+  // Return number of reserved slots. Zero means the queue is finished.
+  std::size_t Size() const { return first.size + second.size; }
+
+  bool Empty() const { return Size() == 0; }
+
+  // Access the `index`-th reserved slot in queue order.
+  T& operator[](std::size_t index) const {
+    return index < first.size ? first.data[index]
+                              : second.data[index - first.size];
+  }
+};
+
 namespace internal {
 
-template <typename T, std::size_t MaxSize>
+// Trivially copyable elements of limited size queues are stored by
+// `ConcurrentQueueContainer<T, MaxSize, true>`.
+template <typename T, std::size_t MaxSize,
+          bool Trivial = std::is_trivially_copyable<T>::value &&
+                         MaxSize != ConcurrentQueueUnlimitedSize>
 class ConcurrentQueueContainer {
  public:
   ConcurrentQueueContainer() : head_(0), tail_(0), size_(0) {
@@ -101,8 +187,135 @@ class ConcurrentQueueContainer {
   std::size_t size_;
 };
 
+// A circular buffer of raw storage for trivially copyable elements. Elements
+// are copied in and out without constructor or destructor calls, and bulk
+// transfers take at most two `memcpy`s, one on each side of the wraparound.
+template <typename T, std::size_t MaxSize>
+class ConcurrentQueueContainer<T, MaxSize, true> {
+ public:
+  ConcurrentQueueContainer()
+      : data_(new Slot[MaxSize]), head_(0), tail_(0), size_(0) {}
+  ConcurrentQueueContainer(const ConcurrentQueueContainer& other)
+      : data_(new Slot[MaxSize]),
+        head_(other.head_),
+        tail_(other.tail_),
+        size_(other.size_) {
+    std::memcpy(data_.get(), other.data_.get(), MaxSize * sizeof(Slot));
+  }
+  // The moved-from container is left empty with a new buffer.
+  ConcurrentQueueContainer(ConcurrentQueueContainer&& other)
+      : data_(new Slot[MaxSize]), head_(0), tail_(0), size_(0) {
+    *this = std::move(other);
+  }
+  ConcurrentQueueContainer& operator=(const ConcurrentQueueContainer& other) {
+    std::memcpy(data_.get(), other.data_.get(), MaxSize * sizeof(Slot));
+    head_ = other.head_;
+    tail_ = other.tail_;
+    size_ = other.size_;
+    return *this;
+  }
+  ConcurrentQueueContainer& operator=(ConcurrentQueueContainer&& other) {
+    data_.swap(other.data_);
+    head_ = other.head_;
+    tail_ = other.tail_;
+    size_ = other.size_;
+    other.head_ = other.tail_ = other.size_ = 0;
+    return *this;
+  }
+
+  template <typename U>
+  void Push(U&& value) {
+    assert(size_ < MaxSize);
+    new (At(tail_)) T(std::forward<U>(value));
+    tail_ = Next(tail_, 1);
+    ++size_;
+  }
+
+  void Push() {
+    assert(size_ < MaxSize);
+    new (At(tail_)) T();
+    tail_ = Next(tail_, 1);
+    ++size_;
+  }
+
+  void Pop(T& value) {
+    assert(size_ > 0);
+    std::memcpy(&value, At(head_), sizeof(T));
+    head_ = Next(head_, 1);
+    --size_;
+  }
+
+  void Pop() {
+    assert(size_ > 0);
+    head_ = Next(head_, 1);
+    --size_;
+  }
+
+  // Copy `n` elements from `items` into back.
+  void PushBulk(const T* items, std::size_t n) {
+    assert(n <= MaxSize - size_);
+    std::size_t first = MaxSize - tail_ < n ? MaxSize - tail_ : n;
+    std::memcpy(At(tail_), items, first * sizeof(T));
+    std::memcpy(At(0), items + first, (n - first) * sizeof(T));
+    tail_ = Next(tail_, n);
+    size_ += n;
+  }
+
+  // Copy `n` elements from front to `items`.
+  void PopBulk(T* items, std::size_t n) {
+    assert(n <= size_);
+    std::size_t first = MaxSize - head_ < n ? MaxSize - head_ : n;
+    std::memcpy(items, At(head_), first * sizeof(T));
+    std::memcpy(items + first, At(0), (n - first) * sizeof(T));
+    head_ = Next(head_, n);
+    size_ -= n;
+  }
+
+  // Hand out `n` free slots after the tail without publishing them, so they
+  // can be written in place.
+  ConcurrentQueueReservation<T> Reserve(std::size_t n) {
+    assert(n <= MaxSize - size_);
+    ConcurrentQueueReservation<T> reservation;
+    std::size_t first = MaxSize - tail_ < n ? MaxSize - tail_ : n;
+    reservation.first = {At(tail_), first};
+    reservation.second = {At(0), n - first};
+    return reservation;
+  }
+
+  // Publish the first `n` slots handed out by the last `Reserve`.
+  void Commit(std::size_t n) {
+    assert(n <= MaxSize - size_);
+    tail_ = Next(tail_, n);
+    size_ += n;
+  }
+
+  std::size_t Size() const { return size_; }
+
+  std::size_t Capacity() const { return MaxSize; }
+
+  bool Empty() const { return size_ == 0; }
+
+  bool Full() const { return size_ == MaxSize; }
+
+ private:
+  struct Slot {
+    alignas(T) unsigned char data[sizeof(T)];
+  };
+
+  T* At(std::size_t index) { return reinterpret_cast<T*>(data_[index].data); }
+
+  static std::size_t Next(std::size_t index, std::size_t n) {
+    return index < MaxSize - n ? index + n : index + n - MaxSize;
+  }
+
+  std::unique_ptr<Slot[]> data_;
+  std::size_t head_;
+  std::size_t tail_;
+  std::size_t size_;
+};
+
 template <typename T>
-class ConcurrentQueueContainer<T, ConcurrentQueueUnlimitedSize> {
+class ConcurrentQueueContainer<T, ConcurrentQueueUnlimitedSize, false> {
  public:
   ConcurrentQueueContainer() = default;
   ConcurrentQueueContainer(const ConcurrentQueueContainer&) = default;
@@ -140,7 +353,7 @@ class ConcurrentQueueContainer<T, ConcurrentQueueUnlimitedSize> {
 };
 
 template <std::size_t MaxSize>
-class ConcurrentQueueContainer<void, MaxSize> {
+class ConcurrentQueueContainer<void, MaxSize, false> {
  public:
   ConcurrentQueueContainer() : size_(0) {}
   ConcurrentQueueContainer(const ConcurrentQueueContainer&) = default;
@@ -172,7 +385,7 @@ class ConcurrentQueueContainer<void, MaxSize> {
 };
 
 template <>
-class ConcurrentQueueContainer<void, ConcurrentQueueUnlimitedSize> {
+class ConcurrentQueueContainer<void, ConcurrentQueueUnlimitedSize, false> {
  public:
   ConcurrentQueueContainer() : size_(0) {}
   ConcurrentQueueContainer(const ConcurrentQueueContainer&) = default;
@@ -199,16 +412,25 @@ class ConcurrentQueueContainer<void, ConcurrentQueueUnlimitedSize> {
 };
 }  // namespace internal
 
-template <typename T, std::size_t MaxSize = ConcurrentQueueUnlimitedSize>
+// `Container` holds the elements and is only accessed with the lock held. It
+// can be replaced to change how elements are stored, see `SpillingContainer`.
+template <typename T, std::size_t MaxSize = ConcurrentQueueUnlimitedSize,
+          typename Container = internal::ConcurrentQueueContainer<T, MaxSize>>
 class ConcurrentQueue {
+  // Used by the tokens, defined in the private section below.
+  struct Rotation;
+  struct SubQueue;
+
  public:
   ConcurrentQueue() = default;
+  // Construct with a prepared container, e.g. one configured with options.
+  explicit ConcurrentQueue(Container data) : data_(std::move(data)) {}
   ConcurrentQueue(const ConcurrentQueue& other) {
     std::lock(lock_, other.lock_);
     std::lock_guard<std::mutex> guard1(lock_, std::adopt_lock);
     std::lock_guard<std::mutex> guard2(other.lock_, std::adopt_lock);
     data_ = other.data_;
-    finished_ = other.finished_;
+    finished_ = other.finished_.load();
     WakeupAll();
     other.WakeupAll();
   };
@@ -217,9 +439,11 @@ class ConcurrentQueue {
     std::lock_guard<std::mutex> guard1(lock_, std::adopt_lock);
     std::lock_guard<std::mutex> guard2(other.lock_, std::adopt_lock);
     data_ = std::move(other.data_);
-    finished_ = other.finished_;
+    finished_ = other.finished_.load();
     WakeupAll();
     other.WakeupAll();
+    // The moved-from queue may have become empty.
+    other.UpdateReadiness();
   }
   ConcurrentQueue& operator=(const ConcurrentQueue& other) {
     if (this != &other) {
@@ -227,9 +451,10 @@ class ConcurrentQueue {
       std::lock_guard<std::mutex> guard1(lock_, std::adopt_lock);
       std::lock_guard<std::mutex> guard2(other.lock_, std::adopt_lock);
       data_ = other.data_;
-      finished_ = other.finished_;
+      finished_ = other.finished_.load();
       WakeupAll();
       other.WakeupAll();
+      UpdateReadiness();
     }
     return *this;
   }
@@ -239,14 +464,21 @@ class ConcurrentQueue {
       std::lock_guard<std::mutex> guard1(lock_, std::adopt_lock);
       std::lock_guard<std::mutex> guard2(other.lock_, std::adopt_lock);
       data_ = std::move(other.data_);
-      finished_ = other.finished_;
+      finished_ = other.finished_.load();
       WakeupAll();
       other.WakeupAll();
+      UpdateReadiness();
+      other.UpdateReadiness();
     }
     return *this;
   }
 
-  ~ConcurrentQueue() { SetFinish(); }
+  ~ConcurrentQueue() {
+    SetFinish();
+#ifdef FOX_CQ_HAS_EVENTFD
+    if (event_fd_ >= 0) close(event_fd_);
+#endif
+  }
 
   // Mark the queue has no more `Push` operation.
   // `Push` operation after `SetFinish` will be ignored.
@@ -254,8 +486,14 @@ class ConcurrentQueue {
   // queue.
   void SetFinish() {
     {
-      std::lock_guard<std::mutex> guard{lock_};
+      std::unique_lock<std::mutex> lk{lock_};
       finished_ = true;
+      FOX_CQ_PROBE(finish, this, TotalSize());
+      // Wait for token pushes that have not seen `finished_`.
+      for (const auto& sub_queue : sub_queues_) {
+        std::lock_guard<std::mutex> guard{sub_queue->lock};
+      }
+      NotifyWaiters(lk);
     }
     WakeupAll();
   }
@@ -283,7 +521,7 @@ class ConcurrentQueue {
   // Return true on success.
   // Return false on failure (trying to
   // pop from an empty queue).
-  bool TryPop() { return TryPopImpl(); }
+  bool TryPop() { return TryPopImpl(rotation_, 1); }
 
   // Pop out the front element to `result`. (non-blocking, return immediately)
   // Return true on success.
@@ -293,14 +531,14 @@ class ConcurrentQueue {
   template <typename U = T>
   bool TryPop(
       typename std::enable_if<!std::is_same<U, void>::value, U&>::type result) {
-    return TryPopImpl(result);
+    return TryPopImpl(rotation_, 1, result);
   }
 
   // Pop out and discard the front element, will wait for element to push. (blocking, may wait other thread to push new element)
   // Return true on success.
   // Return false on failure (trying to
   // pop from a finished and empty queue).
-  bool Pop() { return PopImpl(); }
+  bool Pop() { return PopImpl(rotation_, 1); }
 
   // Pop out the front element to `result`, will wait for element to push. (blocking, may wait other thread to push new element)
   // Return true on success.
@@ -310,13 +548,450 @@ class ConcurrentQueue {
   template <typename U = T>
   bool Pop(
       typename std::enable_if<!std::is_same<U, void>::value, U&>::type result) {
-    return PopImpl(result);
+    return PopImpl(rotation_, 1, result);
+  }
+
+  // Gives a producer its own sub-queue inside the queue, so pushing with the
+  // token only contends with consumers of that sub-queue instead of every
+  // producer. Only the push making the sub-queues non-empty takes the lock
+  // of the queue, if a consumer sleeps. Consumers take turns on the
+  // sub-queues, elements pushed with one token are popped in order.
+  // Only supported by unlimited size queues. The token should not outlive the
+  // queue, and elements pushed with it are not copied or moved with the
+  // queue.
+  class ProducerToken {
+   public:
+    explicit ProducerToken(ConcurrentQueue& queue) : queue_(&queue) {
+      static_assert(MaxSize == ConcurrentQueueUnlimitedSize,
+                    "Tokens are only supported by unlimited size queues");
+      std::lock_guard<std::mutex> guard{queue_->lock_};
+      sub_queue_ = new SubQueue();
+      queue_->sub_queues_.emplace_back(sub_queue_);
+    }
+    ProducerToken(const ProducerToken&) = delete;
+    ProducerToken& operator=(const ProducerToken&) = delete;
+
+    // Elements left in the sub-queue are still popped.
+    ~ProducerToken() {
+      std::lock_guard<std::mutex> guard{queue_->lock_};
+      sub_queue_->detached = true;
+      queue_->RemoveDrainedSubQueue(sub_queue_);
+    }
+
+   private:
+    friend class ConcurrentQueue;
+
+    ConcurrentQueue* queue_;
+    SubQueue* sub_queue_;
+  };
+
+  // Lets a consumer pop a batch of elements from one sub-queue before moving
+  // on to the next one, starting from a different sub-queue than other
+  // consumers.
+  class ConsumerToken {
+   public:
+    explicit ConsumerToken(ConcurrentQueue& queue) {
+      std::lock_guard<std::mutex> guard{queue.lock_};
+      rotation_.position = queue.consumer_tokens_++;
+    }
+
+   private:
+    friend class ConcurrentQueue;
+
+    Rotation rotation_;
+  };
+
+  // Push a default constructed new item into back of the sub-queue of `token`
+  void Push(ProducerToken& token) { PushImpl(token); }
+
+  // Move and push `item` into back of the sub-queue of `token`
+  // Enabled when T != void
+  template <typename U = T>
+  void Push(
+      ProducerToken& token,
+      typename std::enable_if<!std::is_same<U, void>::value, U&&>::type item) {
+    PushImpl(token, std::move(item));
+  }
+
+  // Copy and push `item` into back of the sub-queue of `token`
+  // Enabled when T != void
+  template <typename U = T>
+  void Push(ProducerToken& token,
+            typename std::enable_if<!std::is_same<U, void>::value,
+                                    const U&>::type item) {
+    PushImpl(token, item);
+  }
+
+  // Same as `TryPop()`, taking turns on the sub-queues with `token`.
+  bool TryPop(ConsumerToken& token) {
+    return TryPopImpl(token.rotation_, kConsumerTokenBatch);
+  }
+
+  // Same as `TryPop(result)`, taking turns on the sub-queues with `token`.
+  // Enabled when T != void
+  template <typename U = T>
+  bool TryPop(
+      ConsumerToken& token,
+      typename std::enable_if<!std::is_same<U, void>::value, U&>::type result) {
+    return TryPopImpl(token.rotation_, kConsumerTokenBatch, result);
+  }
+
+  // Same as `Pop()`, taking turns on the sub-queues with `token`.
+  bool Pop(ConsumerToken& token) {
+    return PopImpl(token.rotation_, kConsumerTokenBatch);
+  }
+
+  // Same as `Pop(result)`, taking turns on the sub-queues with `token`.
+  // Enabled when T != void
+  template <typename U = T>
+  bool Pop(
+      ConsumerToken& token,
+      typename std::enable_if<!std::is_same<U, void>::value, U&>::type result) {
+    return PopImpl(token.rotation_, kConsumerTokenBatch, result);
+  }
+
+  // Wait until `n` consecutive slots are free and hand them out for writing in
+  // place, avoiding the copy of `Push`. (blocking, may wait other thread to pop)
+  // Other producers wait until the reservation is committed.
+  // Return an empty reservation if the queue is finished, or if `n` is
+  // greater than `MaxSize` since it would never fit.
+  // Enabled when T is trivially copyable and the queue has limit.
+  template <typename U = T>
+  typename std::enable_if<std::is_trivially_copyable<U>::value &&
+                              MaxSize != ConcurrentQueueUnlimitedSize,
+                          ConcurrentQueueReservation<U>>::type
+  Reserve(std::size_t n) {
+    if (n == 0 || n > MaxSize) {
+      return ConcurrentQueueReservation<U>{{nullptr, 0}, {nullptr, 0}};
+    }
+    std::unique_lock<std::mutex> lk{lock_};
+    auto reservable = [this, n] {
+      return (reserved_ == 0 && !throttled_ && MaxSize - data_.Size() >= n) ||
+             finished_;
+    };
+    if (!reservable()) {
+      ++reserve_waiters_;
+      FOX_CQ_PROBE(wait__begin, this, 1);
+      full_cond_.wait(lk, reservable);
+      FOX_CQ_PROBE(wait__end, this, 1);
+      --reserve_waiters_;
+    }
+    if (finished_) {
+      // finished, should notify other threads to stop waiting.
+      WakeupAll();
+      return ConcurrentQueueReservation<U>{{nullptr, 0}, {nullptr, 0}};
+    }
+    reserved_ = n;
+    return data_.Reserve(n);
+  }
+
+  // Publish the first `n` slots of the outstanding reservation in order and
+  // release the rest of it. `n` is clamped to the size of the reservation.
+  // Slots committed after `SetFinish` will be ignored.
+  // Enabled when T is trivially copyable and the queue has limit.
+  template <typename U = T>
+  typename std::enable_if<std::is_trivially_copyable<U>::value &&
+                          MaxSize != ConcurrentQueueUnlimitedSize>::type
+  Commit(std::size_t n) {
+    std::unique_lock<std::mutex> lk{lock_};
+    if (reserved_ == 0) {
+      // The reservation was empty.
+      return;
+    }
+    if (n > reserved_) n = reserved_;
+    reserved_ = 0;
+    if (!finished_ && n > 0) {
+      data_.Commit(n);
+      FOX_CQ_PROBE(push, this, TotalSize());
+      UpdateThrottle();
+      if (n == 1) {
+        empty_cond_.notify_one();
+      } else {
+        empty_cond_.notify_all();
+      }
+    }
+    // Producers may be waiting for the reservation to be released.
+    full_cond_.notify_all();
+    NotifyWaiters(lk);
+  }
+
+  // Stop producers once the queue holds `high` elements and release them
+  // together once it holds `low` elements or fewer, instead of waking one producer per pop
+  // near full. `on_high` and `on_low` are called with the lock held when the
+  // size crosses the watermarks, and should not use the queue.
+  // `high` should be at most `MaxSize` and greater than `low`. Pass zero
+  // `high` to disable.
+  // Enabled when the queue has limit.
+  template <std::size_t U = MaxSize>
+  typename std::enable_if<U != ConcurrentQueueUnlimitedSize>::type
+  SetWatermarks(std::size_t high, std::size_t low,
+                std::function<void()> on_high = nullptr,
+                std::function<void()> on_low = nullptr) {
+    assert(high == 0 || (low < high && high <= MaxSize));
+    std::unique_lock<std::mutex> lk{lock_};
+    high_watermark_ = high;
+    low_watermark_ = low;
+    on_high_ = std::move(on_high);
+    on_low_ = std::move(on_low);
+    throttled_ = false;
+    UpdateThrottle();
+    full_cond_.notify_all();
+    // Coroutines waiting to push may be released.
+    NotifyWaiters(lk);
+  }
+
+  // Copy `n` elements from `items` into back of the queue in order, will wait
+  // for free slots. (blocking, may wait other thread to pop)
+  // Elements are copied with `memcpy` in chunks as slots become free, so
+  // elements of other producers may come between chunks.
+  // Return number of pushed elements, less than `n` only if the queue is
+  // finished.
+  // Enabled when T is trivially copyable and the queue has limit.
+  template <typename U = T>
+  typename std::enable_if<std::is_trivially_copyable<U>::value &&
+                              MaxSize != ConcurrentQueueUnlimitedSize,
+                          std::size_t>::type
+  PushBulk(const U* items, std::size_t n) {
+    std::unique_lock<std::mutex> lk{lock_};
+    std::size_t pushed = 0;
+    while (pushed < n) {
+      if (!Writable() && !finished_) {
+        FOX_CQ_PROBE(wait__begin, this, 1);
+        full_cond_.wait(lk, [this] { return Writable() || finished_; });
+        FOX_CQ_PROBE(wait__end, this, 1);
+      }
+      if (finished_) {
+        // finished, should notify other threads to stop waiting.
+        WakeupAll();
+        break;
+      }
+      std::size_t chunk = MaxSize - data_.Size();
+      if (high_watermark_ > 0) {
+        // Unthrottled, so the size is below the high watermark.
+        chunk = high_watermark_ - data_.Size();
+      }
+      if (chunk > n - pushed) chunk = n - pushed;
+      data_.PushBulk(items + pushed, chunk);
+      pushed += chunk;
+      FOX_CQ_PROBE(push, this, TotalSize());
+      UpdateThrottle();
+      if (Writable()) {
+        NotifyFull();
+      }
+      if (chunk == 1) {
+        empty_cond_.notify_one();
+      } else {
+        empty_cond_.notify_all();
+      }
+      NotifyWaiters(lk);
+      // Resuming coroutines releases the lock.
+      if (!lk.owns_lock()) lk.lock();
+    }
+    return pushed;
+  }
+
+  // Copy up to `n` front elements to `items` with `memcpy`, will wait for
+  // element to push. (blocking, may wait other thread to push new element)
+  // Return number of popped elements, zero only if `n` is zero or the queue is
+  // finished and empty.
+  // Enabled when T is trivially copyable and the queue has limit.
+  template <typename U = T>
+  typename std::enable_if<std::is_trivially_copyable<U>::value &&
+                              MaxSize != ConcurrentQueueUnlimitedSize,
+                          std::size_t>::type
+  PopBulk(U* items, std::size_t n) {
+    if (n == 0) {
+      return 0;
+    }
+    std::unique_lock<std::mutex> lk{lock_};
+    if (data_.Empty() && !finished_) {
+      FOX_CQ_PROBE(wait__begin, this, 0);
+      empty_cond_.wait(lk, [this] { return !data_.Empty() || finished_; });
+      FOX_CQ_PROBE(wait__end, this, 0);
+    }
+    if (data_.Empty()) {
+      assert(finished_);
+      // finished, should notify other threads to stop waiting.
+      WakeupAll();
+      return 0;
+    }
+    return PopBulkImpl(lk, items, n);
+  }
+
+  // Copy up to `n` front elements to `items` with `memcpy`. (non-blocking,
+  // return immediately)
+  // Return number of popped elements.
+  // Enabled when T is trivially copyable and the queue has limit.
+  template <typename U = T>
+  typename std::enable_if<std::is_trivially_copyable<U>::value &&
+                              MaxSize != ConcurrentQueueUnlimitedSize,
+                          std::size_t>::type
+  TryPopBulk(U* items, std::size_t n) {
+    std::unique_lock<std::mutex> lk{lock_};
+    if (data_.Empty() || n == 0) {
+      return 0;
+    }
+    return PopBulkImpl(lk, items, n);
+  }
+
+#ifdef FOX_CQ_HAS_EVENTFD
+  // Create an eventfd for event loops, which is readable iff the queue is
+  // non-empty or finished. It is only written when the queue becomes
+  // non-empty and only read when the queue becomes empty, so drain the queue
+  // with `TryPop` once it is readable.
+  // Return the eventfd, or -1 if it cannot be created.
+  // Only the queue reads the eventfd, callers should poll it but never read
+  // it, otherwise it stays unreadable while the queue is non-empty.
+  // The eventfd is owned by this queue and not copied or moved with it. A
+  // queue assigned to keeps its eventfd, updated for the new elements.
+  int EnableReadinessNotifier() {
+    std::lock_guard<std::mutex> guard{lock_};
+    if (event_fd_ < 0) {
+      event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      if (event_fd_ >= 0) {
+        AddSleeper();
+        UpdateReadiness();
+      }
+    }
+    return event_fd_;
+  }
+
+  // Return the eventfd created by `EnableReadinessNotifier`, or -1.
+  int NativeHandle() const {
+    std::lock_guard<std::mutex> guard{lock_};
+    return event_fd_;
+  }
+#endif
+
+#ifdef FOX_CQ_HAS_COROUTINE
+  // Resumes a coroutine made ready by the queue.
+  using CoroutineExecutor = std::function<void(std::coroutine_handle<>)>;
+
+ private:
+  // A suspended coroutine waiting in `AsyncPop` or `AsyncPush`. It lives in
+  // the coroutine frame.
+  struct Waiter {
+    Waiter* next = nullptr;
+    std::coroutine_handle<> handle;
+    bool ok = false;
+    // Pop the front element into the waiter, or push the element of the
+    // waiter into back.
+    void (*transfer)(Waiter*, Container&) = nullptr;
+  };
+
+  struct WaiterList {
+    Waiter* head = nullptr;
+    Waiter* tail = nullptr;
+
+    bool Empty() const { return head == nullptr; }
+
+    void PushBack(Waiter* waiter) {
+      waiter->next = nullptr;
+      if (tail) {
+        tail->next = waiter;
+      } else {
+        head = waiter;
+      }
+      tail = waiter;
+    }
+
+    Waiter* PopFront() {
+      Waiter* waiter = head;
+      head = waiter->next;
+      if (!head) tail = nullptr;
+      return waiter;
+    }
+  };
+
+ public:
+  // Awaitable of `AsyncPop`. `co_await` returns true on success, false on a
+  // finished and empty queue.
+  template <typename... Args>
+  class PopAwaiter : private Waiter {
+   public:
+    explicit PopAwaiter(ConcurrentQueue* queue, Args&... result)
+        : queue_(queue), result_(result...) {
+      this->transfer = &PopAwaiter::Transfer;
+    }
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> handle) {
+      return queue_->SuspendPop(this, handle);
+    }
+    bool await_resume() const noexcept { return this->ok; }
+
+   private:
+    static void Transfer(Waiter* waiter, Container& data) {
+      std::apply([&data](Args&... result) { data.Pop(result...); },
+                 static_cast<PopAwaiter*>(waiter)->result_);
+    }
+
+    ConcurrentQueue* queue_;
+    std::tuple<Args&...> result_;
+  };
+
+  // Awaitable of `AsyncPush`. `co_await` returns true on success, false if
+  // the queue is finished and the item is discarded.
+  template <typename... Args>
+  class PushAwaiter : private Waiter {
+   public:
+    explicit PushAwaiter(ConcurrentQueue* queue, Args&&... item)
+        : queue_(queue), item_(std::forward<Args>(item)...) {
+      this->transfer = &PushAwaiter::Transfer;
+    }
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> handle) {
+      return queue_->SuspendPush(this, handle);
+    }
+    bool await_resume() const noexcept { return this->ok; }
+
+   private:
+    static void Transfer(Waiter* waiter, Container& data) {
+      std::apply([&data](Args&... item) { data.Push(std::move(item)...); },
+                 static_cast<PushAwaiter*>(waiter)->item_);
+    }
+
+    ConcurrentQueue* queue_;
+    std::tuple<Args...> item_;
+  };
+
+  // Resume coroutines through `executor` instead of inline on the thread
+  // making them ready. Should be set before any coroutine waits on the queue.
+  void SetCoroutineExecutor(CoroutineExecutor executor) {
+    std::lock_guard<std::mutex> guard{lock_};
+    executor_ = std::move(executor);
+  }
+
+  // Pop out and discard the front element, will suspend the coroutine instead
+  // of the thread until element is pushed.
+  PopAwaiter<> AsyncPop() { return PopAwaiter<>(this); }
+
+  // Pop out the front element to `result`, will suspend the coroutine instead
+  // of the thread until element is pushed.
+  // Enabled when T != void
+  template <typename U = T>
+  PopAwaiter<typename std::enable_if<!std::is_same<U, void>::value, U>::type>
+  AsyncPop(U& result) {
+    return PopAwaiter<U>(this, result);
+  }
+
+  // Push a default constructed new item into back of the queue, will suspend
+  // the coroutine instead of the thread while the queue is full.
+  PushAwaiter<> AsyncPush() { return PushAwaiter<>(this); }
+
+  // Move and push `item` into back of the queue, will suspend the coroutine
+  // instead of the thread while the queue is full.
+  // Enabled when T != void
+  template <typename U = T>
+  PushAwaiter<typename std::enable_if<!std::is_same<U, void>::value, U>::type>
+  AsyncPush(U item) {
+    return PushAwaiter<U>(this, std::move(item));
   }
+#endif
 
   // Return number of element in the queue
   std::size_t Size() const {
     std::lock_guard<std::mutex> guard{lock_};
-    return data_.Size();
+    return TotalSize();
   }
 
   // Return true iff this queue has no limit.
@@ -326,6 +1001,23 @@ class ConcurrentQueue {
   bool LimitedSize() const { return MaxSize != ConcurrentQueueUnlimitedSize; }
 
  private:
+  // Where a consumer is in its turn over `data_` (position 0) and the
+  // sub-queues of producer tokens.
+  struct Rotation {
+    std::size_t position = 0;
+    // Number of elements popped at `position` in a row.
+    std::size_t streak = 0;
+  };
+
+  // Elements pushed with one `ProducerToken`. Producers only take `lock`,
+  // consumers take `lock` with `lock_` held.
+  struct SubQueue {
+    std::mutex lock;
+    Container data;
+    // The token is destroyed, remove the sub-queue once it is drained.
+    bool detached = false;
+  };
+
   void WakeupAll() const {
     empty_cond_.notify_all();
     // Full waiting only happens in limited size.
@@ -335,8 +1027,10 @@ class ConcurrentQueue {
   template <typename... Args>
   void PushImpl(Args&&... item) {
     std::unique_lock<std::mutex> lk{lock_};
-    if (LimitedSize() && data_.Full() && !finished_) {
-      full_cond_.wait(lk, [this] { return !data_.Full() || finished_; });
+    if (LimitedSize() && !Writable() && !finished_) {
+      FOX_CQ_PROBE(wait__begin, this, 1);
+      full_cond_.wait(lk, [this] { return Writable() || finished_; });
+      FOX_CQ_PROBE(wait__end, this, 1);
     }
     if (finished_) {
       // finished, should notify other threads to stop waiting.
@@ -344,26 +1038,181 @@ class ConcurrentQueue {
       return;
     }
     data_.Push(std::forward<Args>(item)...);
-    if (LimitedSize() && !data_.Full()) {
-      full_cond_.notify_one();
+    FOX_CQ_PROBE(push, this, TotalSize());
+    UpdateThrottle();
+    if (LimitedSize() && Writable()) {
+      NotifyFull();
     }
     empty_cond_.notify_one();
+    NotifyWaiters(lk);
+  }
+
+  template <typename... Args>
+  void PushImpl(ProducerToken& token, Args&&... item) {
+    assert(token.queue_ == this);
+    SubQueue* sub_queue = token.sub_queue_;
+    std::size_t before;
+    {
+      std::lock_guard<std::mutex> guard{sub_queue->lock};
+      if (finished_) {
+        return;
+      }
+      sub_queue->data.Push(std::forward<Args>(item)...);
+      before = sub_queue_size_.fetch_add(1);
+    }
+    // The main container is only read with the lock held, so only the
+    // sub-queues are counted.
+    FOX_CQ_PROBE(push, this, before + 1);
+    // Waiters only sleep on an empty queue, so the push making the sub-queues
+    // non-empty wakes one up, and it wakes up the next one if elements are
+    // left. Later pushes do not take the lock.
+    if (before > 0) {
+      return;
+    }
+    // Pairs with the fence in `AddSleeper`, either the sleeper sees the
+    // element or this sees the sleeper.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleepers_.load() > 0) {
+      std::unique_lock<std::mutex> lk{lock_};
+      empty_cond_.notify_one();
+      NotifyWaiters(lk);
+    }
+  }
+
+  // Wake up a producer waiting for free slots, with the lock held. A reserver
+  // woken up may need more slots than are free and wait again, so every
+  // producer is woken up while one is waiting.
+  void NotifyFull() {
+    if (reserve_waiters_ > 0) {
+      full_cond_.notify_all();
+    } else {
+      full_cond_.notify_one();
+    }
+  }
+
+  // Return true iff a producer may push an element, with the lock held.
+  bool Writable() const {
+    return !data_.Full() && reserved_ == 0 && !throttled_;
+  }
+
+  // Throttle producers once the size reaches the high watermark, and release
+  // them all at once when it falls to the low watermark, with the lock held.
+  // The low watermark is inclusive, so a zero `low` releases them on empty.
+  void UpdateThrottle() {
+    if (high_watermark_ == 0) {
+      return;
+    }
+    if (!throttled_ && data_.Size() >= high_watermark_) {
+      throttled_ = true;
+      if (on_high_) on_high_();
+    } else if (throttled_ && data_.Size() <= low_watermark_) {
+      throttled_ = false;
+      if (on_low_) on_low_();
+      full_cond_.notify_all();
+    }
+  }
+
+  // Return number of element in the queue, with the lock held.
+  std::size_t TotalSize() const {
+    return data_.Size() + sub_queue_size_.load();
+  }
+
+  // Return true iff an element can be popped, with the lock held.
+  bool HasElement() const {
+    return !data_.Empty() || sub_queue_size_.load() > 0;
+  }
+
+  // Announce a waiter that token pushes should wake up.
+  void AddSleeper() {
+    sleepers_.fetch_add(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+  }
+
+  // Pop the next element with `pop(container)`, staying on one sub-queue for
+  // at most `batch` elements in a row. Should only be called with the lock
+  // held and `HasElement()`.
+  template <typename F>
+  void PopNext(Rotation& rotation, std::size_t batch, F pop) {
+    if (sub_queue_size_.load() == 0) {
+      pop(data_);
+      return;
+    }
+    std::size_t n = sub_queues_.size() + 1;
+    if (rotation.streak >= batch) {
+      ++rotation.position;
+      rotation.streak = 0;
+    }
+    for (std::size_t i = 0; i < n; i++) {
+      std::size_t index = (rotation.position + i) % n;
+      bool found = false;
+      if (index == 0) {
+        if (!data_.Empty()) {
+          pop(data_);
+          found = true;
+        }
+      } else {
+        SubQueue* sub_queue = sub_queues_[index - 1].get();
+        std::unique_lock<std::mutex> sub_lk{sub_queue->lock};
+        if (!sub_queue->data.Empty()) {
+          pop(sub_queue->data);
+          sub_queue_size_.fetch_sub(1);
+          sub_lk.unlock();
+          RemoveDrainedSubQueue(sub_queue);
+          found = true;
+        }
+      }
+      if (found) {
+        if (i > 0) {
+          rotation.position = index;
+          rotation.streak = 0;
+        }
+        ++rotation.streak;
+        return;
+      }
+    }
+    assert(false);
+  }
+
+  // Remove `sub_queue` if its token is destroyed and it is drained, with the
+  // lock held.
+  void RemoveDrainedSubQueue(SubQueue* sub_queue) {
+    // No one pushes to a detached sub-queue, and consumers hold the lock.
+    if (!sub_queue->detached || !sub_queue->data.Empty()) {
+      return;
+    }
+    for (auto it = sub_queues_.begin(); it != sub_queues_.end(); ++it) {
+      if (it->get() == sub_queue) {
+        sub_queues_.erase(it);
+        return;
+      }
+    }
   }
 
   template <typename... Args>
-  bool PopImpl(Args&&... result) {
+  bool PopImpl(Rotation& rotation, std::size_t batch, Args&&... result) {
     std::unique_lock<std::mutex> lk{lock_};
-    empty_cond_.wait(lk, [this] { return !data_.Empty() || finished_; });
-    if (!data_.Empty()) {
-      data_.Pop(std::forward<Args>(result)...);
-      if (!data_.Empty()) {
+    if (!HasElement() && !finished_) {
+      AddSleeper();
+      FOX_CQ_PROBE(wait__begin, this, 0);
+      empty_cond_.wait(lk, [this] { return HasElement() || finished_; });
+      FOX_CQ_PROBE(wait__end, this, 0);
+      sleepers_.fetch_sub(1);
+    }
+    if (HasElement()) {
+      PopNext(rotation, batch, [&](Container& data) {
+        data.Pop(std::forward<Args>(result)...);
+      });
+      FOX_CQ_PROBE(pop, this, TotalSize());
+      UpdateThrottle();
+      if (HasElement()) {
         empty_cond_.notify_one();
       } else if (finished_) {
         // finished, should notify other threads to stop waiting.
         WakeupAll();
         return true;
       }
-      if (LimitedSize()) full_cond_.notify_one();
+      if (LimitedSize() && !throttled_) NotifyFull();
+      NotifyWaiters(lk);
 
       return true;
     }
@@ -374,22 +1223,432 @@ class ConcurrentQueue {
     return false;
   }
 
+  // Pop up to `n` elements with the lock held and the queue non-empty.
+  std::size_t PopBulkImpl(std::unique_lock<std::mutex>& lk, T* items,
+                          std::size_t n) {
+    if (n > data_.Size()) n = data_.Size();
+    data_.PopBulk(items, n);
+    FOX_CQ_PROBE(pop, this, TotalSize());
+    UpdateThrottle();
+    if (throttled_) {
+      // Producers are released at the low watermark.
+    } else if (n == 1) {
+      NotifyFull();
+    } else {
+      full_cond_.notify_all();
+    }
+    if (!data_.Empty()) {
+      empty_cond_.notify_one();
+    }
+    NotifyWaiters(lk);
+    return n;
+  }
+
   template <typename... Args>
-  bool TryPopImpl(Args&&... result) {
+  bool TryPopImpl(Rotation& rotation, std::size_t batch, Args&&... result) {
     std::unique_lock<std::mutex> lk{lock_};
-    if (!data_.Empty()) {
-      data_.Pop(std::forward<Args>(result)...);
+    if (HasElement()) {
+      PopNext(rotation, batch, [&](Container& data) {
+        data.Pop(std::forward<Args>(result)...);
+      });
+      FOX_CQ_PROBE(pop, this, TotalSize());
+      UpdateThrottle();
 
-      if (LimitedSize()) full_cond_.notify_one();
+      if (LimitedSize() && !throttled_) NotifyFull();
+      NotifyWaiters(lk);
       return true;
     }
     return false;
   }
 
+#ifdef FOX_CQ_HAS_COROUTINE
+  bool SuspendPop(Waiter* waiter, std::coroutine_handle<> handle) {
+    std::unique_lock<std::mutex> lk{lock_};
+    if (!HasElement() && !finished_) {
+      AddSleeper();
+      if (!HasElement()) {
+        // Stays a sleeper until it is taken off `pop_waiters_`.
+        waiter->handle = handle;
+        pop_waiters_.PushBack(waiter);
+        return true;
+      }
+      sleepers_.fetch_sub(1);
+    }
+    if (HasElement()) {
+      PopNext(rotation_, 1, [waiter](Container& data) {
+        waiter->transfer(waiter, data);
+      });
+      waiter->ok = true;
+      FOX_CQ_PROBE(pop, this, TotalSize());
+      UpdateThrottle();
+      if (LimitedSize() && !throttled_) NotifyFull();
+      NotifyWaiters(lk);
+      return false;
+    }
+    assert(finished_);
+    waiter->ok = false;
+    return false;
+  }
+
+  bool SuspendPush(Waiter* waiter, std::coroutine_handle<> handle) {
+    std::unique_lock<std::mutex> lk{lock_};
+    if (finished_) {
+      waiter->ok = false;
+      return false;
+    }
+    if (push_waiters_.Empty() && Writable()) {
+      waiter->transfer(waiter, data_);
+      waiter->ok = true;
+      FOX_CQ_PROBE(push, this, TotalSize());
+      UpdateThrottle();
+      empty_cond_.notify_one();
+      NotifyWaiters(lk);
+      return false;
+    }
+    waiter->handle = handle;
+    push_waiters_.PushBack(waiter);
+    return true;
+  }
+
+  // Notify waiters not sleeping on the condition variables after the queue
+  // changed: hand elements and free slots to waiting coroutines, update the
+  // readiness notifier, then resume the coroutines without the lock held.
+  void NotifyWaiters(std::unique_lock<std::mutex>& lk) {
+    if (pop_waiters_.Empty() && push_waiters_.Empty()) {
+      UpdateReadiness();
+      return;
+    }
+    WaiterList ready;
+    bool popped = false;
+    bool pushed = false;
+    bool progress = true;
+    while (progress) {
+      progress = false;
+      while (!pop_waiters_.Empty() && HasElement()) {
+        Waiter* waiter = pop_waiters_.PopFront();
+        sleepers_.fetch_sub(1);
+        PopNext(rotation_, 1, [waiter](Container& data) {
+          waiter->transfer(waiter, data);
+        });
+        waiter->ok = true;
+        FOX_CQ_PROBE(pop, this, TotalSize());
+        UpdateThrottle();
+        ready.PushBack(waiter);
+        popped = progress = true;
+      }
+      while (!push_waiters_.Empty() && Writable() && !finished_) {
+        Waiter* waiter = push_waiters_.PopFront();
+        waiter->transfer(waiter, data_);
+        waiter->ok = true;
+        FOX_CQ_PROBE(push, this, TotalSize());
+        UpdateThrottle();
+        ready.PushBack(waiter);
+        pushed = progress = true;
+      }
+    }
+    if (finished_) {
+      while (!push_waiters_.Empty()) {
+        Waiter* waiter = push_waiters_.PopFront();
+        waiter->ok = false;
+        ready.PushBack(waiter);
+      }
+      while (!pop_waiters_.Empty()) {
+        Waiter* waiter = pop_waiters_.PopFront();
+        sleepers_.fetch_sub(1);
+        waiter->ok = false;
+        ready.PushBack(waiter);
+      }
+    }
+    if (pushed) empty_cond_.notify_all();
+    if (popped && LimitedSize() && !throttled_) full_cond_.notify_all();
+    UpdateReadiness();
+    lk.unlock();
+    while (!ready.Empty()) {
+      // The waiter is gone once its coroutine is resumed.
+      std::coroutine_handle<> handle = ready.PopFront()->handle;
+      if (executor_) {
+        executor_(handle);
+      } else {
+        handle.resume();
+      }
+    }
+  }
+#else
+  void NotifyWaiters(std::unique_lock<std::mutex>&) { UpdateReadiness(); }
+#endif
+
+#ifdef FOX_CQ_HAS_EVENTFD
+  // Make the eventfd readable iff the queue is non-empty or finished. Only
+  // transitions cost a system call.
+  // An unreadable eventfd counts as a sleeper, so token pushes update it.
+  void UpdateReadiness() {
+    if (event_fd_ < 0) {
+      return;
+    }
+    bool ready = HasElement() || finished_;
+    if (!ready && event_signaled_) {
+      std::uint64_t count;
+      ssize_t n = read(event_fd_, &count, sizeof(count));
+      (void)n;
+      event_signaled_ = false;
+      AddSleeper();
+      // A token push may have missed the sleeper.
+      ready = HasElement();
+    }
+    if (ready && !event_signaled_) {
+      std::uint64_t one = 1;
+      ssize_t n = write(event_fd_, &one, sizeof(one));
+      (void)n;
+      event_signaled_ = true;
+      sleepers_.fetch_sub(1);
+    }
+  }
+#else
+  void UpdateReadiness() {}
+#endif
+
   mutable std::mutex lock_;
   mutable std::condition_variable empty_cond_;
   mutable std::condition_variable full_cond_;
-  internal::ConcurrentQueueContainer<T, MaxSize> data_;
+  Container data_;
+  // Atomic so token pushes can check it without the lock.
+  std::atomic<bool> finished_{false};
+  // Number of slots a producer holds from `Reserve` that are not committed
+  // yet.
+  std::size_t reserved_ = 0;
+  // Number of producers waiting in `Reserve`, which may need more than one
+  // free slot.
+  std::size_t reserve_waiters_ = 0;
+  // Watermarks set by `SetWatermarks`, disabled when `high_watermark_` is 0.
+  std::size_t high_watermark_ = 0;
+  std::size_t low_watermark_ = 0;
+  std::function<void()> on_high_;
+  std::function<void()> on_low_;
+  // Producers wait for the size to fall to the low watermark.
+  bool throttled_ = false;
+  // Number of elements a consumer token pops from one sub-queue in a row.
+  static const std::size_t kConsumerTokenBatch = 64;
+  // Sub-queues of producer tokens, the vector is guarded by the lock.
+  std::vector<std::unique_ptr<SubQueue>> sub_queues_;
+  // Number of elements in the sub-queues, changed with the lock of the
+  // sub-queue held.
+  std::atomic<std::size_t> sub_queue_size_{0};
+  // Number of waiters a token push should wake up with the lock: consumers
+  // sleeping on `empty_cond_`, coroutines in `pop_waiters_` and an unreadable
+  // eventfd.
+  std::atomic<std::size_t> sleepers_{0};
+  Rotation rotation_;
+  std::size_t consumer_tokens_ = 0;
+#ifdef FOX_CQ_HAS_EVENTFD
+  int event_fd_ = -1;
+  bool event_signaled_ = false;
+#endif
+#ifdef FOX_CQ_HAS_COROUTINE
+  WaiterList pop_waiters_;
+  WaiterList push_waiters_;
+  CoroutineExecutor executor_;
+#endif
+};
+
+// A queue of zero capacity, i.e. a rendezvous channel: `Push` blocks until a
+// consumer takes the element. An element is moved from the producer straight
+// into the result of the consumer, and only the thread on the other side of
+// the handoff is woken, each waiter sleeping on its own condition variable.
+// It supports the blocking and non-blocking operations of `ConcurrentQueue`
+// for T != void, without the coroutine and eventfd ones. It is neither
+// copyable nor movable, since waiting threads point into it.
+template <typename T, typename Container>
+class ConcurrentQueue<T, 0, Container> {
+  static_assert(!std::is_same<T, void>::value,
+                "Zero capacity queue of void is not supported");
+
+ public:
+  ConcurrentQueue() = default;
+  ConcurrentQueue(const ConcurrentQueue&) = delete;
+  ConcurrentQueue& operator=(const ConcurrentQueue&) = delete;
+
+  ~ConcurrentQueue() { SetFinish(); }
+
+  // Mark the queue has no more `Push` operation.
+  // `Push` operation after `SetFinish` will be ignored, and elements of
+  // producers still waiting for a consumer are discarded.
+  void SetFinish() {
+    std::lock_guard<std::mutex> guard{lock_};
+    finished_ = true;
+    FOX_CQ_PROBE(finish, this, 0);
+    while (!push_waiters_.Empty()) {
+      Complete(push_waiters_.PopFront(), false);
+    }
+    while (!pop_waiters_.Empty()) {
+      Complete(pop_waiters_.PopFront(), false);
+    }
+  }
+
+  // Push a default constructed new item, will wait for a consumer to take it.
+  // (blocking, may wait other thread to pop)
+  void Push() {
+    T item{};
+    PushImpl(item);
+  }
+
+  // Move and push `item`, will wait for a consumer to take it. (blocking, may
+  // wait other thread to pop)
+  void Push(T&& item) { PushImpl(item); }
+
+  // Copy and push `item`, will wait for a consumer to take it. (blocking, may
+  // wait other thread to pop)
+  void Push(const T& item) {
+    T copy(item);
+    PushImpl(copy);
+  }
+
+  // Take and discard the element of a waiting producer. (non-blocking, return
+  // immediately)
+  // T should be default constructible.
+  // Return true on success.
+  // Return false on failure (no producer is waiting).
+  bool TryPop() {
+    T result;
+    return TryPop(result);
+  }
+
+  // Take the element of a waiting producer to `result`. (non-blocking, return
+  // immediately)
+  // Return true on success.
+  // Return false on failure (no producer is waiting).
+  bool TryPop(T& result) {
+    std::lock_guard<std::mutex> guard{lock_};
+    if (push_waiters_.Empty()) {
+      return false;
+    }
+    TakeFrom(push_waiters_.PopFront(), result);
+    return true;
+  }
+
+  // Take and discard the element of a producer, will wait for a producer to
+  // push. (blocking, may wait other thread to push new element)
+  // T should be default constructible.
+  // Return true on success.
+  // Return false on failure (trying to
+  // pop from a finished queue).
+  bool Pop() {
+    T result;
+    return Pop(result);
+  }
+
+  // Take the element of a producer to `result`, will wait for a producer to
+  // push. (blocking, may wait other thread to push new element)
+  // Return true on success.
+  // Return false on failure (trying to
+  // pop from a finished queue).
+  bool Pop(T& result) {
+    std::unique_lock<std::mutex> lk{lock_};
+    if (!push_waiters_.Empty()) {
+      TakeFrom(push_waiters_.PopFront(), result);
+      return true;
+    }
+    if (finished_) {
+      return false;
+    }
+    // Wait for a producer to move its element into `result`.
+    Waiter waiter(&result);
+    pop_waiters_.PushBack(&waiter);
+    FOX_CQ_PROBE(wait__begin, this, 0);
+    waiter.cond.wait(lk, [&waiter] { return waiter.done; });
+    FOX_CQ_PROBE(wait__end, this, 0);
+    return waiter.ok;
+  }
+
+  // Return number of producers waiting for a consumer
+  std::size_t Size() const {
+    std::lock_guard<std::mutex> guard{lock_};
+    return push_waiters_.Size();
+  }
+
+  // Return true iff this queue has no limit.
+  bool UnlimitedSize() const { return false; }
+
+  // Return true iff this queue has limit.
+  bool LimitedSize() const { return true; }
+
+ private:
+  // A thread waiting for the other side of a handoff. It lives on the stack
+  // of the waiting thread.
+  struct Waiter {
+    explicit Waiter(T* slot) : slot(slot) {}
+
+    std::condition_variable cond;
+    // The element of a producer, or the result of a consumer.
+    T* slot;
+    Waiter* next = nullptr;
+    bool done = false;
+    bool ok = false;
+  };
+
+  struct WaiterList {
+    Waiter* head = nullptr;
+    Waiter* tail = nullptr;
+    std::size_t size = 0;
+
+    bool Empty() const { return head == nullptr; }
+
+    std::size_t Size() const { return size; }
+
+    void PushBack(Waiter* waiter) {
+      if (tail) {
+        tail->next = waiter;
+      } else {
+        head = waiter;
+      }
+      tail = waiter;
+      ++size;
+    }
+
+    Waiter* PopFront() {
+      Waiter* waiter = head;
+      head = waiter->next;
+      if (!head) tail = nullptr;
+      --size;
+      return waiter;
+    }
+  };
+
+  // Wake up only `waiter`, with the lock held.
+  static void Complete(Waiter* waiter, bool ok) {
+    waiter->ok = ok;
+    waiter->done = true;
+    waiter->cond.notify_one();
+  }
+
+  void TakeFrom(Waiter* producer, T& result) {
+    result = std::move(*producer->slot);
+    FOX_CQ_PROBE(pop, this, 0);
+    Complete(producer, true);
+  }
+
+  void PushImpl(T& item) {
+    std::unique_lock<std::mutex> lk{lock_};
+    if (finished_) {
+      return;
+    }
+    if (!pop_waiters_.Empty()) {
+      Waiter* consumer = pop_waiters_.PopFront();
+      *consumer->slot = std::move(item);
+      FOX_CQ_PROBE(push, this, 0);
+      Complete(consumer, true);
+      return;
+    }
+    // Wait for a consumer to move the element out of `item`.
+    Waiter waiter(&item);
+    push_waiters_.PushBack(&waiter);
+    FOX_CQ_PROBE(wait__begin, this, 1);
+    waiter.cond.wait(lk, [&waiter] { return waiter.done; });
+    FOX_CQ_PROBE(wait__end, this, 1);
+  }
+
+  mutable std::mutex lock_;
+  WaiterList pop_waiters_;
+  WaiterList push_waiters_;
   bool finished_ = false;
 };
 
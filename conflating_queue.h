@@ -0,0 +1,197 @@
+/**
+ * @author Hanwen Zheng
+ * @email eserinc.z@outlook.com
+ * @create date 2026-10-18 19:05:41
+ * @modify date 2026-10-18 19:05:41
+ * @desc An unlimited size concurrent queue keeping only the latest value of
+ * each key, using std::mutex and std::condition_variable.
+ */
+#pragma once
+#include <cassert>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace fox_cq {
+
+// A queue of key value pairs where pushing a key that is still pending
+// replaces its value in place, keeping the position of the first push. So the
+// queue holds at most one entry per distinct key, however fast a key is
+// updated.
+// Entries live in a circular buffer indexed by sequence number, and an open
+// addressed hash table maps each pending key to its sequence number.
+// K and V should be default constructible.
+template <typename K, typename V, typename Hash = std::hash<K>,
+          typename KeyEqual = std::equal_to<K>>
+class ConflatingQueue {
+ public:
+  ConflatingQueue() : head_(0), tail_(0) { Rebuild(kInitialCapacity); }
+  ConflatingQueue(const ConflatingQueue&) = delete;
+  ConflatingQueue& operator=(const ConflatingQueue&) = delete;
+
+  ~ConflatingQueue() { SetFinish(); }
+
+  // Mark the queue has no more `Push` operation.
+  // `Push` operation after `SetFinish` will be ignored.
+  // Notice that `Pop` operation still works for remaining elements in the
+  // queue.
+  void SetFinish() {
+    std::lock_guard<std::mutex> guard{lock_};
+    finished_ = true;
+    empty_cond_.notify_all();
+  }
+
+  // Push `value` for `key` into back of the queue, or replace the pending
+  // value of `key` without moving it.
+  void Push(const K& key, V value) {
+    std::lock_guard<std::mutex> guard{lock_};
+    if (finished_) {
+      return;
+    }
+    std::size_t index = Find(key);
+    if (index_[index] != kNone) {
+      At(index_[index]).value = std::move(value);
+      return;
+    }
+    if (tail_ - head_ == entries_.size()) {
+      Rebuild(entries_.size() * 2);
+      index = Find(key);
+    }
+    Entry& entry = At(tail_);
+    entry.key = key;
+    entry.value = std::move(value);
+    index_[index] = tail_++;
+    empty_cond_.notify_one();
+  }
+
+  // Pop out the front entry to `key` and `value`. (non-blocking, return
+  // immediately)
+  // Return true on success.
+  // Return false on failure (trying to
+  // pop from an empty queue).
+  bool TryPop(K& key, V& value) {
+    std::lock_guard<std::mutex> guard{lock_};
+    if (head_ == tail_) {
+      return false;
+    }
+    PopFront(key, value);
+    return true;
+  }
+
+  // Pop out the front entry to `key` and `value`, will wait for entry to push.
+  // (blocking, may wait other thread to push new entry)
+  // Return true on success.
+  // Return false on failure (trying to
+  // pop from a finished and empty queue).
+  bool Pop(K& key, V& value) {
+    std::unique_lock<std::mutex> lk{lock_};
+    empty_cond_.wait(lk, [this] { return head_ != tail_ || finished_; });
+    if (head_ != tail_) {
+      PopFront(key, value);
+      if (head_ != tail_) {
+        empty_cond_.notify_one();
+      }
+      return true;
+    }
+
+    assert(finished_);
+    // finished, should notify other threads to stop waiting.
+    empty_cond_.notify_all();
+    return false;
+  }
+
+  // Return number of pending keys in the queue
+  std::size_t Size() const {
+    std::lock_guard<std::mutex> guard{lock_};
+    return static_cast<std::size_t>(tail_ - head_);
+  }
+
+ private:
+  struct Entry {
+    K key;
+    V value;
+  };
+
+  // Marks an unused slot of the index.
+  static const std::uint64_t kNone = static_cast<std::uint64_t>(-1);
+  // Must be a power of two.
+  static const std::size_t kInitialCapacity = 16;
+
+  Entry& At(std::uint64_t seq) {
+    return entries_[static_cast<std::size_t>(seq) & (entries_.size() - 1)];
+  }
+
+  std::size_t Home(const K& key) const {
+    return hasher_(key) & (index_.size() - 1);
+  }
+
+  // Return the slot of the index holding `key`, or the unused slot ending its
+  // probe sequence.
+  std::size_t Find(const K& key) {
+    std::size_t mask = index_.size() - 1;
+    for (std::size_t i = Home(key);; i = (i + 1) & mask) {
+      if (index_[i] == kNone || equal_(At(index_[i]).key, key)) {
+        return i;
+      }
+    }
+  }
+
+  void PopFront(K& key, V& value) {
+    Entry& entry = At(head_);
+    Erase(Find(entry.key));
+    key = std::move(entry.key);
+    value = std::move(entry.value);
+    entry = Entry();
+    ++head_;
+  }
+
+  // Free slot `i` of the index, shifting back later entries of its probe
+  // sequence so lookups never stop early.
+  void Erase(std::size_t i) {
+    std::size_t mask = index_.size() - 1;
+    for (std::size_t j = (i + 1) & mask; index_[j] != kNone;
+         j = (j + 1) & mask) {
+      std::size_t home = Home(At(index_[j]).key);
+      // Move the entry at `j` to `i` unless its home lies in (i, j].
+      if (((j - home) & mask) >= ((j - i) & mask)) {
+        index_[i] = index_[j];
+        i = j;
+      }
+    }
+    index_[i] = kNone;
+  }
+
+  // Grow the buffer to `capacity` entries, keeping the index at most half
+  // full.
+  void Rebuild(std::size_t capacity) {
+    std::vector<Entry> entries(capacity);
+    for (std::uint64_t seq = head_; seq != tail_; seq++) {
+      entries[static_cast<std::size_t>(seq) & (capacity - 1)] =
+          std::move(At(seq));
+    }
+    entries_.swap(entries);
+    std::uint64_t none = kNone;
+    index_.assign(capacity * 2, none);
+    for (std::uint64_t seq = head_; seq != tail_; seq++) {
+      index_[Find(At(seq).key)] = seq;
+    }
+  }
+
+  mutable std::mutex lock_;
+  std::condition_variable empty_cond_;
+  std::vector<Entry> entries_;
+  // Sequence numbers of pending entries, addressed by key hash.
+  std::vector<std::uint64_t> index_;
+  // Sequence number of the front entry.
+  std::uint64_t head_;
+  // Sequence number of the next entry pushed.
+  std::uint64_t tail_;
+  Hash hasher_;
+  KeyEqual equal_;
+  bool finished_ = false;
+};
+
+}  // namespace fox_cq
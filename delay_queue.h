@@ -0,0 +1,302 @@
+/**
+ * @author Hanwen Zheng
+ * @email eserinc.z@outlook.com
+ * @create date 2026-10-18 20:26:37
+ * @modify date 2026-10-18 20:26:37
+ * @desc An unlimited size concurrent queue whose elements become visible once
+ * they are due, using std::mutex and std::condition_variable.
+ */
+#pragma once
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace fox_cq {
+
+namespace internal {
+
+inline int CountTrailingZeros(std::uint64_t x) {
+  assert(x != 0);
+#if defined(__GNUC__)
+  return __builtin_ctzll(x);
+#else
+  int n = 0;
+  while (!(x & 1)) {
+    x >>= 1;
+    ++n;
+  }
+  return n;
+#endif
+}
+
+}  // namespace internal
+
+// A queue where `Push(item, due_time)` makes `item` visible to `Pop` once
+// `due_time` has passed. Elements due in the same tick are popped in push
+// order.
+// Pending elements are kept in a hierarchical timer wheel of 4 levels of 64
+// slots, where level `L` holds elements due within `64^(L+1)` ticks, so a push
+// is O(1) without heap sift. A slot is cascaded into the lower levels when the
+// wheel reaches it, and a bitmap per level finds the next non-empty slot.
+// Elements further than `64^4` ticks away wait in an overflow list.
+template <typename T, typename Clock = std::chrono::steady_clock>
+class DelayQueue {
+ public:
+  using time_point = typename Clock::time_point;
+  using duration = typename Clock::duration;
+
+  // `tick` is the resolution of due times. Elements are never popped before
+  // they are due, and at most about one tick after.
+  explicit DelayQueue(duration tick = std::chrono::milliseconds(1))
+      : tick_(tick),
+        start_(Clock::now()),
+        current_(0),
+        wheel_size_(0),
+        wait_tick_(kNever) {
+    assert(tick > duration::zero());
+    for (std::uint64_t& bitmap : bitmaps_) {
+      bitmap = 0;
+    }
+  }
+  DelayQueue(const DelayQueue&) = delete;
+  DelayQueue& operator=(const DelayQueue&) = delete;
+
+  ~DelayQueue() { SetFinish(); }
+
+  // Mark the queue has no more `Push` operation.
+  // `Push` operation after `SetFinish` will be ignored.
+  // Notice that `Pop` operation still works for remaining elements in the
+  // queue, waiting for them to be due.
+  void SetFinish() {
+    std::lock_guard<std::mutex> guard{lock_};
+    finished_ = true;
+    empty_cond_.notify_all();
+  }
+
+  // Move and push `item`, which becomes visible at `due_time`
+  void Push(T&& item, time_point due_time) {
+    PushImpl(std::move(item), due_time);
+  }
+
+  // Copy and push `item`, which becomes visible at `due_time`
+  void Push(const T& item, time_point due_time) { PushImpl(item, due_time); }
+
+  // Pop out the earliest due element to `result`. (non-blocking, return
+  // immediately)
+  // Return true on success.
+  // Return false on failure (no element is due).
+  bool TryPop(T& result) {
+    std::lock_guard<std::mutex> guard{lock_};
+    Advance(NowTick());
+    if (ready_.empty()) {
+      return false;
+    }
+    PopReady(result);
+    return true;
+  }
+
+  // Pop out the earliest due element to `result`, will wait for it to be due
+  // or for an element to push. (blocking, sleeps until the next due time)
+  // Return true on success.
+  // Return false on failure (trying to
+  // pop from a finished and empty queue).
+  bool Pop(T& result) {
+    std::unique_lock<std::mutex> lk{lock_};
+    while (true) {
+      Advance(NowTick());
+      if (!ready_.empty()) {
+        PopReady(result);
+        return true;
+      }
+      if (wheel_size_ == 0 && finished_) {
+        // finished, should notify other threads to stop waiting.
+        empty_cond_.notify_all();
+        return false;
+      }
+      std::uint64_t next = NextEventTick();
+      wait_tick_ = next;
+      if (next == kNever) {
+        empty_cond_.wait(lk);
+      } else {
+        empty_cond_.wait_until(lk, TimeOf(next));
+      }
+    }
+  }
+
+  // Return number of element in the queue, due or not
+  std::size_t Size() const {
+    std::lock_guard<std::mutex> guard{lock_};
+    return ready_.size() + wheel_size_;
+  }
+
+ private:
+  struct Entry {
+    std::uint64_t due;
+    T item;
+  };
+
+  static const int kLevels = 4;
+  static const int kSlotBits = 6;
+  static const std::uint64_t kSlots = 1 << kSlotBits;
+  static const std::uint64_t kNever = static_cast<std::uint64_t>(-1);
+
+  // Return the first tick not earlier than `time`.
+  std::uint64_t TickOf(time_point time) const {
+    if (time <= start_) {
+      return 0;
+    }
+    return static_cast<std::uint64_t>((time - start_ + tick_ - duration(1)) /
+                                      tick_);
+  }
+
+  std::uint64_t NowTick() const {
+    return static_cast<std::uint64_t>((Clock::now() - start_) / tick_);
+  }
+
+  time_point TimeOf(std::uint64_t tick) const {
+    return start_ + tick_ * static_cast<typename duration::rep>(tick);
+  }
+
+  template <typename U>
+  void PushImpl(U&& item, time_point due_time) {
+    std::lock_guard<std::mutex> guard{lock_};
+    if (finished_) {
+      return;
+    }
+    Entry entry{TickOf(due_time), std::forward<U>(item)};
+    std::uint64_t due = entry.due;
+    Insert(std::move(entry));
+    if (due <= current_) {
+      empty_cond_.notify_one();
+    } else if (due < wait_tick_) {
+      // Earlier than what consumers sleep for.
+      wait_tick_ = due;
+      empty_cond_.notify_one();
+    }
+  }
+
+  void PopReady(T& result) {
+    result = std::move(ready_.front());
+    ready_.pop_front();
+    // Someone else should pop the next due element, or take over sleeping
+    // until it is due.
+    if (!ready_.empty() || wheel_size_ > 0) {
+      empty_cond_.notify_one();
+    }
+  }
+
+  // Put `entry` into the level covering its distance from the current tick,
+  // or into `ready_` if it is due.
+  void Insert(Entry&& entry) {
+    if (entry.due <= current_) {
+      ready_.push_back(std::move(entry.item));
+      return;
+    }
+    std::uint64_t diff = entry.due ^ current_;
+    for (int level = 0; level < kLevels; level++) {
+      int shift = level * kSlotBits;
+      if (diff < kSlots << shift) {
+        std::uint64_t slot = (entry.due >> shift) & (kSlots - 1);
+        slots_[level][slot].push_back(std::move(entry));
+        bitmaps_[level] |= std::uint64_t(1) << slot;
+        ++wheel_size_;
+        return;
+      }
+    }
+    overflow_.push_back(std::move(entry));
+    ++wheel_size_;
+  }
+
+  // Take out the entries of `list` and insert them again relative to the
+  // current tick.
+  void Reinsert(std::vector<Entry>& list) {
+    std::vector<Entry> entries;
+    entries.swap(list);
+    wheel_size_ -= entries.size();
+    for (Entry& entry : entries) {
+      Insert(std::move(entry));
+    }
+  }
+
+  // Return the next tick at which a slot fires or cascades, or `kNever`.
+  std::uint64_t NextEventTick() const {
+    std::uint64_t next = kNever;
+    for (int level = 0; level < kLevels; level++) {
+      int shift = level * kSlotBits;
+      std::uint64_t position = (current_ >> shift) & (kSlots - 1);
+      // Pending slots of a level are after the position of the current tick.
+      std::uint64_t later =
+          position == kSlots - 1
+              ? 0
+              : bitmaps_[level] & (~std::uint64_t(0) << (position + 1));
+      if (later == 0) {
+        continue;
+      }
+      std::uint64_t slot = internal::CountTrailingZeros(later);
+      std::uint64_t block = current_ >> (shift + kSlotBits) << (shift + kSlotBits);
+      std::uint64_t tick = block | (slot << shift);
+      if (tick < next) next = tick;
+    }
+    if (!overflow_.empty()) {
+      int shift = kLevels * kSlotBits;
+      std::uint64_t tick = ((current_ >> shift) + 1) << shift;
+      if (tick < next) next = tick;
+    }
+    return next;
+  }
+
+  // Move the wheel to `now`, cascading and firing the slots passed on the way
+  // into `ready_`. Empty slots are skipped with the bitmaps.
+  void Advance(std::uint64_t now) {
+    while (current_ < now) {
+      std::uint64_t next = NextEventTick();
+      if (next > now) {
+        current_ = now;
+        return;
+      }
+      current_ = next;
+      int shift = kLevels * kSlotBits;
+      if ((current_ & ((std::uint64_t(1) << shift) - 1)) == 0) {
+        Reinsert(overflow_);
+      }
+      for (int level = kLevels - 1; level >= 0; level--) {
+        shift = level * kSlotBits;
+        if ((current_ & ((std::uint64_t(1) << shift) - 1)) != 0) {
+          continue;
+        }
+        std::uint64_t slot = (current_ >> shift) & (kSlots - 1);
+        if (bitmaps_[level] & (std::uint64_t(1) << slot)) {
+          bitmaps_[level] &= ~(std::uint64_t(1) << slot);
+          // Entries of a level 0 slot are due and go to `ready_`.
+          Reinsert(slots_[level][slot]);
+        }
+      }
+    }
+  }
+
+  mutable std::mutex lock_;
+  std::condition_variable empty_cond_;
+  const duration tick_;
+  const time_point start_;
+  // Number of ticks since `start_` the wheel has reached.
+  std::uint64_t current_;
+  std::vector<Entry> slots_[kLevels][kSlots];
+  // Bit `i` of `bitmaps_[L]` is set iff `slots_[L][i]` is non-empty.
+  std::uint64_t bitmaps_[kLevels];
+  std::vector<Entry> overflow_;
+  // Number of elements in the wheel and the overflow list.
+  std::size_t wheel_size_;
+  // Due elements in order.
+  std::deque<T> ready_;
+  // The tick sleeping consumers wait for, pushes of earlier elements wake one
+  // up.
+  std::uint64_t wait_tick_;
+  bool finished_ = false;
+};
+
+}  // namespace fox_cq
@@ -0,0 +1,105 @@
+/**
+ * @author Hanwen Zheng
+ * @email eserinc.z@outlook.com
+ * @create date 2026-10-18 15:05:36
+ * @modify date 2026-10-18 15:05:36
+ * @desc An example of many coroutine consumers sharing a few threads. This
+ * source file is supposed to be compile with '-std=c++20'.
+ */
+#include <atomic>
+#include <cassert>
+#include <coroutine>
+#include <exception>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "../concurrent_queue.h"
+
+#ifndef FOX_CQ_HAS_COROUTINE
+#error "This example requires C++20 coroutines."
+#endif
+
+// A coroutine started eagerly and destroyed when it finishes.
+struct Task {
+  struct promise_type {
+    Task get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+const int NumConsumer = 1000;
+const int NumProducer = 4;
+const int NumItem = 100000;
+
+using CQueue = fox_cq::ConcurrentQueue<int, 64>;
+std::atomic<long long> sum{0};
+std::atomic<int> nstopped{0};
+std::atomic<int> ncompleted{0};
+
+Task Consumer(CQueue& queue) {
+  int value;
+  while (co_await queue.AsyncPop(value)) {
+    sum += value;
+  }
+  ++nstopped;
+}
+
+Task Producer(CQueue& queue, int l, int r) {
+  for (int i = l; i < r; i++) {
+    co_await queue.AsyncPush(i);
+  }
+  ++ncompleted;
+}
+
+void WaitFor(const std::atomic<int>& counter, int value) {
+  while (counter != value) {
+    std::this_thread::yield();
+  }
+}
+
+int main() {
+  std::cout << " -----Example_coroutine begin----" << std::endl;
+  // Two worker threads run every coroutine made ready by the queue.
+  fox_cq::ConcurrentQueue<std::coroutine_handle<>> run_queue;
+  std::vector<std::thread> workers;
+  for (int i = 0; i < 2; i++) {
+    workers.emplace_back([&run_queue] {
+      std::coroutine_handle<> handle;
+      while (run_queue.Pop(handle)) {
+        handle.resume();
+      }
+    });
+  }
+
+  CQueue queue;
+  queue.SetCoroutineExecutor(
+      [&run_queue](std::coroutine_handle<> handle) { run_queue.Push(handle); });
+  for (int i = 0; i < NumConsumer; i++) {
+    Consumer(queue);
+  }
+  for (int i = 0; i < NumProducer; i++) {
+    int l = i * NumItem / NumProducer;
+    int r = (i + 1) * NumItem / NumProducer;
+    Producer(queue, l, r);
+  }
+  WaitFor(ncompleted, NumProducer);
+  // Resume every waiting consumer with a finished result.
+  queue.SetFinish();
+  WaitFor(nstopped, NumConsumer);
+  run_queue.SetFinish();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+
+  long long expected = static_cast<long long>(NumItem - 1) * NumItem / 2;
+  std::cout << "Consumers can catch all the production from producer? "
+            << (sum == expected ? "Yes" : "No") << std::endl;
+  assert(sum == expected);
+  std::cout << "Passed" << std::endl;
+  std::cout << " -----Example_coroutine end----" << std::endl;
+  return 0;
+}
@@ -0,0 +1,182 @@
+/**
+ * @author Hanwen Zheng
+ * @email eserinc.z@outlook.com
+ * @create date 2026-10-18 22:37:19
+ * @modify date 2026-10-18 22:37:19
+ * @desc An unlimited size concurrent queue sharing consumers fairly among
+ * tenants, using std::mutex and std::condition_variable.
+ */
+#pragma once
+#include <cassert>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+namespace fox_cq {
+
+// A queue keeping one FIFO per tenant and serving tenants with deficit round
+// robin, so a tenant pushing a lot cannot starve the others. Each turn a tenant
+// may pop up to its weight in elements before the next tenant goes, so tenants
+// with pending elements get pops in proportion to their weights.
+// Tenants with pending elements wait in a round robin list, making every pop
+// O(1). Tenants are kept once seen, together with their weights.
+template <typename TenantId, typename T, typename Hash = std::hash<TenantId>>
+class FairQueue {
+ public:
+  // Tenants without `SetWeight` get `default_weight`.
+  explicit FairQueue(std::uint32_t default_weight = 1)
+      : default_weight_(default_weight), size_(0) {
+    assert(default_weight > 0);
+  }
+  FairQueue(const FairQueue&) = delete;
+  FairQueue& operator=(const FairQueue&) = delete;
+
+  ~FairQueue() { SetFinish(); }
+
+  // Mark the queue has no more `Push` operation.
+  // `Push` operation after `SetFinish` will be ignored.
+  // Notice that `Pop` operation still works for remaining elements in the
+  // queue.
+  void SetFinish() {
+    std::lock_guard<std::mutex> guard{lock_};
+    finished_ = true;
+    empty_cond_.notify_all();
+  }
+
+  // Let `tenant` pop `weight` elements per turn. Takes effect from its next
+  // turn.
+  void SetWeight(const TenantId& tenant, std::uint32_t weight) {
+    assert(weight > 0);
+    std::lock_guard<std::mutex> guard{lock_};
+    GetTenant(tenant).weight = weight;
+  }
+
+  // Move and push `item` into back of the queue of `tenant`
+  void Push(const TenantId& tenant, T&& item) {
+    PushImpl(tenant, std::move(item));
+  }
+
+  // Copy and push `item` into back of the queue of `tenant`
+  void Push(const TenantId& tenant, const T& item) { PushImpl(tenant, item); }
+
+  // Pop out the front element of the tenant in turn to `result`.
+  // (non-blocking, return immediately)
+  // Return true on success.
+  // Return false on failure (trying to
+  // pop from an empty queue).
+  bool TryPop(T& result) {
+    std::lock_guard<std::mutex> guard{lock_};
+    if (size_ == 0) {
+      return false;
+    }
+    PopNext(result);
+    return true;
+  }
+
+  // Pop out the front element of the tenant in turn to `result`, will wait for
+  // element to push. (blocking, may wait other thread to push new element)
+  // Return true on success.
+  // Return false on failure (trying to
+  // pop from a finished and empty queue).
+  bool Pop(T& result) {
+    std::unique_lock<std::mutex> lk{lock_};
+    empty_cond_.wait(lk, [this] { return size_ > 0 || finished_; });
+    if (size_ > 0) {
+      PopNext(result);
+      if (size_ > 0) {
+        empty_cond_.notify_one();
+      }
+      return true;
+    }
+
+    assert(finished_);
+    // finished, should notify other threads to stop waiting.
+    empty_cond_.notify_all();
+    return false;
+  }
+
+  // Return number of element in the queue
+  std::size_t Size() const {
+    std::lock_guard<std::mutex> guard{lock_};
+    return size_;
+  }
+
+  // Return number of element of `tenant` in the queue
+  std::size_t Size(const TenantId& tenant) const {
+    std::lock_guard<std::mutex> guard{lock_};
+    auto it = tenants_.find(tenant);
+    return it == tenants_.end() ? 0 : it->second.items.size();
+  }
+
+ private:
+  struct Tenant {
+    std::deque<T> items;
+    std::uint32_t weight;
+    // Number of elements the tenant may still pop in its turn.
+    std::uint32_t deficit = 0;
+  };
+
+  Tenant& GetTenant(const TenantId& tenant) {
+    auto it = tenants_.find(tenant);
+    if (it == tenants_.end()) {
+      it = tenants_.emplace(tenant, Tenant()).first;
+      it->second.weight = default_weight_;
+    }
+    return it->second;
+  }
+
+  template <typename U>
+  void PushImpl(const TenantId& tenant, U&& item) {
+    std::lock_guard<std::mutex> guard{lock_};
+    if (finished_) {
+      return;
+    }
+    Tenant& entry = GetTenant(tenant);
+    entry.items.push_back(std::forward<U>(item));
+    if (entry.items.size() == 1) {
+      // Elements in `unordered_map` do not move, so the pointer stays valid.
+      active_.push_back(&entry);
+    }
+    ++size_;
+    empty_cond_.notify_one();
+  }
+
+  // Pop from the tenant at the front of the round robin, with the lock held
+  // and the queue non-empty.
+  void PopNext(T& result) {
+    assert(!active_.empty());
+    Tenant* tenant = active_.front();
+    if (tenant->deficit == 0) {
+      // A new turn of the tenant.
+      tenant->deficit = tenant->weight;
+    }
+    result = std::move(tenant->items.front());
+    tenant->items.pop_front();
+    --tenant->deficit;
+    --size_;
+    if (tenant->items.empty()) {
+      // An idle tenant does not keep its credit.
+      tenant->deficit = 0;
+      active_.pop_front();
+    } else if (tenant->deficit == 0) {
+      active_.pop_front();
+      active_.push_back(tenant);
+    }
+  }
+
+  mutable std::mutex lock_;
+  std::condition_variable empty_cond_;
+  std::unordered_map<TenantId, Tenant, Hash> tenants_;
+  // Tenants with pending elements in round robin order, the front one is in
+  // its turn.
+  std::deque<Tenant*> active_;
+  const std::uint32_t default_weight_;
+  std::size_t size_;
+  bool finished_ = false;
+};
+
+}  // namespace fox_cq
@@ -0,0 +1,409 @@
+/**
+ * @author Hanwen Zheng
+ * @email eserinc.z@outlook.com
+ * @create date 2026-10-18 17:32:10
+ * @modify date 2026-10-18 17:32:10
+ * @desc An unlimited size concurrent queue whose `Push` and `TryPop` are
+ * lock-free, using std::mutex and std::condition_variable only to sleep on an
+ * empty queue.
+ */
+#pragma once
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace fox_cq {
+
+namespace internal {
+
+// A fixed size array of cells filled and drained with fetch-and-add indices.
+// Segments are linked into an unlimited size queue.
+template <typename T>
+struct LockFreeSegment {
+  static const std::size_t kSize = 1024;
+
+  // Nothing written yet.
+  static const std::uint32_t kEmpty = 0;
+  // Claimed by a producer constructing the element.
+  static const std::uint32_t kWriting = 1;
+  // Holding an element.
+  static const std::uint32_t kFull = 2;
+  // Drained, or abandoned by a consumer before any producer claimed it.
+  static const std::uint32_t kTaken = 3;
+
+  struct Cell {
+    std::atomic<std::uint32_t> state{kEmpty};
+    alignas(T) unsigned char data[sizeof(T)];
+
+    T* Get() { return reinterpret_cast<T*>(data); }
+  };
+
+  explicit LockFreeSegment(std::uint64_t id) : id(id) {}
+
+  // Position of this segment in the queue, for `Size`.
+  const std::uint64_t id;
+  alignas(64) std::atomic<std::size_t> enq_idx{0};
+  alignas(64) std::atomic<std::size_t> deq_idx{0};
+  std::atomic<LockFreeSegment*> next{nullptr};
+  // Link in the list of segments waiting to be freed.
+  LockFreeSegment* retired_next = nullptr;
+  Cell cells[kSize];
+};
+
+}  // namespace internal
+
+// An unlimited size queue made of linked segments. Producers and consumers
+// claim cells with fetch-and-add on per segment indices instead of sharing a
+// lock, and drained segments are freed with hazard pointers.
+// Only `Pop` on an empty queue takes the lock, to sleep until an element is
+// pushed or the queue is finished.
+template <typename T>
+class LockFreeConcurrentQueue {
+  using Segment = internal::LockFreeSegment<T>;
+
+ public:
+  LockFreeConcurrentQueue()
+      : records_(nullptr), retired_(nullptr), retired_count_(0) {
+    Segment* segment = new Segment(0);
+    head_.store(segment);
+    tail_.store(segment);
+  }
+  LockFreeConcurrentQueue(const LockFreeConcurrentQueue&) = delete;
+  LockFreeConcurrentQueue& operator=(const LockFreeConcurrentQueue&) = delete;
+
+  // No other thread should use the queue any more.
+  ~LockFreeConcurrentQueue() {
+    SetFinish();
+    Segment* segment = head_.load();
+    while (segment) {
+      std::size_t begin = segment->deq_idx.load();
+      for (std::size_t i = begin; i < Segment::kSize; i++) {
+        if (segment->cells[i].state.load() == Segment::kFull) {
+          segment->cells[i].Get()->~T();
+        }
+      }
+      Segment* next = segment->next.load();
+      delete segment;
+      segment = next;
+    }
+    FreeRetired(retired_.exchange(nullptr), false);
+    HazardRecord* record = records_.load();
+    while (record) {
+      HazardRecord* next = record->next;
+      delete record;
+      record = next;
+    }
+  }
+
+  // Mark the queue has no more `Push` operation.
+  // `Push` operation after `SetFinish` will be ignored.
+  // Notice that `Pop` operation still works for remaining elements in the
+  // queue.
+  void SetFinish() {
+    finished_.store(true);
+    std::lock_guard<std::mutex> guard{lock_};
+    empty_cond_.notify_all();
+  }
+
+  // Push a default constructed new item into back of the queue (lock-free)
+  void Push() { PushImpl(); }
+
+  // Move and push `item` into back of the queue (lock-free)
+  void Push(T&& item) { PushImpl(std::move(item)); }
+
+  // Copy and push `item` into back of of the queue (lock-free)
+  void Push(const T& item) { PushImpl(item); }
+
+  // Pop out and discard the front element. (non-blocking, lock-free)
+  // Return true on success.
+  // Return false on failure (trying to
+  // pop from an empty queue).
+  bool TryPop() { return TryPopImpl(); }
+
+  // Pop out the front element to `result`. (non-blocking, lock-free)
+  // Return true on success.
+  // Return false on failure (trying to
+  // pop from an empty queue).
+  bool TryPop(T& result) { return TryPopImpl(result); }
+
+  // Pop out and discard the front element, will wait for element to push.
+  // (blocking, may wait other thread to push new element)
+  // Return true on success.
+  // Return false on failure (trying to
+  // pop from a finished and empty queue).
+  bool Pop() { return PopImpl(); }
+
+  // Pop out the front element to `result`, will wait for element to push.
+  // (blocking, may wait other thread to push new element)
+  // Return true on success.
+  // Return false on failure (trying to
+  // pop from a finished and empty queue).
+  bool Pop(T& result) { return PopImpl(result); }
+
+  // Return approximate number of element in the queue
+  std::size_t Size() {
+    HazardRecord* record = AcquireRecord();
+    Segment* head = Protect(head_, record, 0);
+    Segment* tail = Protect(tail_, record, 1);
+    std::uint64_t begin = Position(head, head->deq_idx.load());
+    std::uint64_t end = Position(tail, tail->enq_idx.load());
+    ReleaseRecord(record);
+    return end > begin ? static_cast<std::size_t>(end - begin) : 0;
+  }
+
+  // Return true iff this queue has no limit.
+  bool UnlimitedSize() const { return true; }
+
+  // Return true iff this queue has limit.
+  bool LimitedSize() const { return false; }
+
+ private:
+  // Hazard pointers of one operation in progress. Records are linked in a
+  // list that only grows, one record per operation running at the same time
+  // at most, and are freed with the queue.
+  struct alignas(64) HazardRecord {
+    std::atomic<bool> active{false};
+    std::atomic<Segment*> hazards[2];
+    HazardRecord* next = nullptr;
+
+    HazardRecord() {
+      hazards[0].store(nullptr);
+      hazards[1].store(nullptr);
+    }
+  };
+
+  // Number of retired segments to collect before freeing them.
+  static const std::size_t kRetireThreshold = 256;
+
+  static std::uint64_t Position(Segment* segment, std::size_t idx) {
+    std::size_t size = Segment::kSize;
+    return segment->id * size + (idx < size ? idx : size);
+  }
+
+  // Claim a free record, or add a new one if every record is in use, so no
+  // operation waits for another.
+  HazardRecord* AcquireRecord() {
+    for (HazardRecord* record = records_.load(std::memory_order_acquire);
+         record; record = record->next) {
+      if (!record->active.load(std::memory_order_relaxed) &&
+          !record->active.exchange(true, std::memory_order_acquire)) {
+        return record;
+      }
+    }
+    HazardRecord* record = new HazardRecord();
+    record->active.store(true, std::memory_order_relaxed);
+    record->next = records_.load(std::memory_order_relaxed);
+    while (!records_.compare_exchange_weak(record->next, record,
+                                           std::memory_order_release,
+                                           std::memory_order_relaxed)) {
+    }
+    return record;
+  }
+
+  void ReleaseRecord(HazardRecord* record) {
+    record->hazards[0].store(nullptr, std::memory_order_release);
+    record->hazards[1].store(nullptr, std::memory_order_release);
+    record->active.store(false, std::memory_order_release);
+  }
+
+  // Load `src` and publish it as hazardous so it is not freed while used.
+  Segment* Protect(const std::atomic<Segment*>& src, HazardRecord* record,
+                   int index) {
+    Segment* segment = src.load();
+    while (true) {
+      record->hazards[index].store(segment);
+      Segment* again = src.load();
+      if (again == segment) {
+        return segment;
+      }
+      segment = again;
+    }
+  }
+
+  template <typename... Args>
+  void PushImpl(Args&&... item) {
+    if (finished_.load(std::memory_order_relaxed)) {
+      return;
+    }
+    HazardRecord* record = AcquireRecord();
+    Enqueue(record, std::forward<Args>(item)...);
+    ReleaseRecord(record);
+    // Pairs with the fence in `Pop`, either the sleeper sees the element or
+    // this sees the sleeper.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleepers_.load() > 0) {
+      std::lock_guard<std::mutex> guard{lock_};
+      empty_cond_.notify_one();
+    }
+  }
+
+  template <typename... Args>
+  void Enqueue(HazardRecord* record, Args&&... item) {
+    while (true) {
+      Segment* tail = Protect(tail_, record, 0);
+      std::size_t idx = tail->enq_idx.fetch_add(1);
+      if (idx < Segment::kSize) {
+        typename Segment::Cell& cell = tail->cells[idx];
+        std::uint32_t expected = Segment::kEmpty;
+        if (cell.state.compare_exchange_strong(expected, Segment::kWriting)) {
+          new (cell.Get()) T(std::forward<Args>(item)...);
+          cell.state.store(Segment::kFull, std::memory_order_release);
+          return;
+        }
+        // A consumer gave up on the cell, try the next one.
+        continue;
+      }
+      // The segment is full, move on to the next one.
+      Segment* next = tail->next.load();
+      if (!next) {
+        Segment* segment = new Segment(tail->id + 1);
+        if (tail->next.compare_exchange_strong(next, segment)) {
+          next = segment;
+        } else {
+          delete segment;
+        }
+      }
+      tail_.compare_exchange_strong(tail, next);
+    }
+  }
+
+  template <typename... Args>
+  bool TryPopImpl(Args&... result) {
+    HazardRecord* record = AcquireRecord();
+    bool suc = Dequeue(record, result...);
+    ReleaseRecord(record);
+    return suc;
+  }
+
+  template <typename... Args>
+  bool PopImpl(Args&... result) {
+    if (TryPopImpl(result...)) {
+      return true;
+    }
+    std::unique_lock<std::mutex> lk{lock_};
+    while (true) {
+      // Announce sleeping before the last check, producers check sleepers
+      // after publishing their element.
+      sleepers_.fetch_add(1);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      bool finished = finished_.load();
+      bool suc = TryPopImpl(result...);
+      if (suc || finished) {
+        sleepers_.fetch_sub(1);
+        return suc;
+      }
+      empty_cond_.wait(lk);
+      sleepers_.fetch_sub(1);
+    }
+  }
+
+  // Move the element out to `result`, or leave it to be destroyed.
+  static void Take(T* item, T& result) { result = std::move(*item); }
+  static void Take(T*) {}
+
+  template <typename... Args>
+  bool Dequeue(HazardRecord* record, Args&... result) {
+    while (true) {
+      Segment* head = Protect(head_, record, 0);
+      if (head->deq_idx.load() >= head->enq_idx.load() &&
+          head->next.load() == nullptr) {
+        return false;
+      }
+      std::size_t idx = head->deq_idx.fetch_add(1);
+      if (idx < Segment::kSize) {
+        typename Segment::Cell& cell = head->cells[idx];
+        std::uint32_t state = cell.state.load(std::memory_order_acquire);
+        if (state == Segment::kEmpty &&
+            cell.state.compare_exchange_strong(state, Segment::kTaken)) {
+          // The producer of this cell has not claimed it yet and will retry
+          // with another cell.
+          continue;
+        }
+        while (state == Segment::kWriting) {
+          // The producer is constructing the element.
+          std::this_thread::yield();
+          state = cell.state.load(std::memory_order_acquire);
+        }
+        assert(state == Segment::kFull);
+        Take(cell.Get(), result...);
+        cell.Get()->~T();
+        cell.state.store(Segment::kTaken, std::memory_order_relaxed);
+        return true;
+      }
+      // The segment is drained, move on to the next one.
+      Segment* next = head->next.load();
+      if (!next) {
+        return false;
+      }
+      // Keep the tail from falling behind the head.
+      Segment* tail = head;
+      tail_.compare_exchange_strong(tail, next);
+      if (head_.compare_exchange_strong(head, next)) {
+        record->hazards[0].store(nullptr);
+        Retire(head);
+      }
+    }
+  }
+
+  void Retire(Segment* segment) {
+    segment->retired_next = retired_.load();
+    while (!retired_.compare_exchange_weak(segment->retired_next, segment)) {
+    }
+    if (retired_count_.fetch_add(1) + 1 >= kRetireThreshold) {
+      retired_count_.store(0);
+      FreeRetired(retired_.exchange(nullptr), true);
+    }
+  }
+
+  // Free segments of `list` no operation is using, and retire the others
+  // again if `check_hazards`.
+  void FreeRetired(Segment* list, bool check_hazards) {
+    std::vector<Segment*> hazards;
+    if (check_hazards) {
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      for (HazardRecord* record = records_.load(); record;
+           record = record->next) {
+        for (std::atomic<Segment*>& hazard : record->hazards) {
+          Segment* segment = hazard.load();
+          if (segment) hazards.push_back(segment);
+        }
+      }
+    }
+    while (list) {
+      Segment* next = list->retired_next;
+      bool hazardous = false;
+      for (Segment* segment : hazards) {
+        hazardous = hazardous || segment == list;
+      }
+      if (hazardous) {
+        list->retired_next = retired_.load();
+        while (!retired_.compare_exchange_weak(list->retired_next, list)) {
+        }
+        retired_count_.fetch_add(1);
+      } else {
+        delete list;
+      }
+      list = next;
+    }
+  }
+
+  alignas(64) std::atomic<Segment*> head_;
+  alignas(64) std::atomic<Segment*> tail_;
+  std::atomic<HazardRecord*> records_;
+  std::atomic<Segment*> retired_;
+  std::atomic<std::size_t> retired_count_;
+
+  std::atomic<bool> finished_{false};
+  // Number of consumers sleeping on `empty_cond_`.
+  std::atomic<std::size_t> sleepers_{0};
+  std::mutex lock_;
+  std::condition_variable empty_cond_;
+};
+
+}  // namespace fox_cq
@@ -0,0 +1,223 @@
+/**
+ * @author Hanwen Zheng
+ * @email eserinc.z@outlook.com
+ * @create date 2026-10-18 19:48:03
+ * @modify date 2026-10-18 19:48:03
+ * @desc An unlimited size concurrent queue keeping elements of one key in
+ * order across parallel consumers, using std::mutex and
+ * std::condition_variable.
+ */
+#pragma once
+#include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace fox_cq {
+
+// A queue hashing keys onto a fixed number of FIFO lanes. A consumer leases a
+// lane and keeps it until it comes back for the next element, so elements of
+// one key are never processed by two consumers at the same time and are
+// processed in push order.
+// Idle consumers take lanes that are non-empty and not leased from a FIFO of
+// ready lanes, and a consumer hands its lane back after `batch` elements in a
+// row so busy lanes cannot starve the others.
+template <typename K, typename T, typename Hash = std::hash<K>>
+class PartitionedQueue {
+ public:
+  // The lane held by one consumer. It is released by the next `Pop` that
+  // moves to another lane, by `Release` or on destruction.
+  // A lease should not outlive its queue, nor be used by two threads.
+  class Lease {
+   public:
+    explicit Lease(PartitionedQueue& queue) : queue_(&queue) {}
+    Lease(const Lease&) = delete;
+    Lease& operator=(const Lease&) = delete;
+    ~Lease() { Release(); }
+
+    // Give the lane back, e.g. before the consumer stops popping.
+    void Release() {
+      std::lock_guard<std::mutex> guard{queue_->lock_};
+      queue_->ReleaseLane(*this);
+    }
+
+   private:
+    friend class PartitionedQueue;
+
+    static const std::size_t kNoLane = static_cast<std::size_t>(-1);
+
+    PartitionedQueue* queue_;
+    std::size_t lane_ = kNoLane;
+    // Number of elements popped from `lane_` in a row.
+    std::size_t streak_ = 0;
+  };
+
+  // `lanes` bounds the parallelism, `batch` is the number of elements a
+  // consumer pops from one lane before letting other lanes go first.
+  explicit PartitionedQueue(std::size_t lanes, std::size_t batch = 16)
+      : lanes_(lanes), batch_(batch), size_(0) {
+    assert(lanes > 0);
+    assert(batch > 0);
+  }
+  PartitionedQueue(const PartitionedQueue&) = delete;
+  PartitionedQueue& operator=(const PartitionedQueue&) = delete;
+
+  ~PartitionedQueue() { SetFinish(); }
+
+  // Mark the queue has no more `Push` operation.
+  // `Push` operation after `SetFinish` will be ignored.
+  // Notice that `Pop` operation still works for remaining elements in the
+  // queue.
+  void SetFinish() {
+    std::lock_guard<std::mutex> guard{lock_};
+    finished_ = true;
+    empty_cond_.notify_all();
+  }
+
+  // Move and push `item` into back of the lane of `key`
+  void Push(const K& key, T&& item) { PushImpl(key, std::move(item)); }
+
+  // Copy and push `item` into back of the lane of `key`
+  void Push(const K& key, const T& item) { PushImpl(key, item); }
+
+  // Pop out the next element of the lane leased by `lease`, or of a ready
+  // lane, to `result`. (non-blocking, return immediately)
+  // Return true on success.
+  // Return false on failure (no element in the lane of `lease` or any ready
+  // lane).
+  bool TryPop(Lease& lease, T& result) {
+    std::lock_guard<std::mutex> guard{lock_};
+    assert(lease.queue_ == this);
+    if (ContinueLane(lease)) {
+      PopFrom(lease, result);
+      return true;
+    }
+    if (ready_.empty()) {
+      return false;
+    }
+    LeaseReadyLane(lease);
+    PopFrom(lease, result);
+    return true;
+  }
+
+  // Pop out the next element of the lane leased by `lease`, or of a ready
+  // lane, to `result`, will wait for element to push. (blocking, may wait
+  // other thread to push new element)
+  // Return true on success.
+  // Return false on failure (trying to
+  // pop from a finished queue without ready lane, lanes leased by others are
+  // drained by their consumers).
+  bool Pop(Lease& lease, T& result) {
+    std::unique_lock<std::mutex> lk{lock_};
+    assert(lease.queue_ == this);
+    if (ContinueLane(lease)) {
+      PopFrom(lease, result);
+      return true;
+    }
+    empty_cond_.wait(lk, [this] { return !ready_.empty() || finished_; });
+    if (!ready_.empty()) {
+      LeaseReadyLane(lease);
+      PopFrom(lease, result);
+      if (!ready_.empty()) {
+        empty_cond_.notify_one();
+      }
+      return true;
+    }
+
+    assert(finished_);
+    // finished, should notify other threads to stop waiting.
+    empty_cond_.notify_all();
+    return false;
+  }
+
+  // Return number of element in the queue
+  std::size_t Size() const {
+    std::lock_guard<std::mutex> guard{lock_};
+    return size_;
+  }
+
+  // Return number of lanes.
+  std::size_t Lanes() const { return lanes_.size(); }
+
+ private:
+  struct Lane {
+    std::deque<T> items;
+    bool leased = false;
+  };
+
+  template <typename U>
+  void PushImpl(const K& key, U&& item) {
+    std::lock_guard<std::mutex> guard{lock_};
+    if (finished_) {
+      return;
+    }
+    std::size_t index = hasher_(key) % lanes_.size();
+    Lane& lane = lanes_[index];
+    lane.items.push_back(std::forward<U>(item));
+    ++size_;
+    if (lane.items.size() == 1 && !lane.leased) {
+      ready_.push_back(index);
+      empty_cond_.notify_one();
+    }
+  }
+
+  // Return true iff `lease` should keep popping from its lane. Otherwise its
+  // lane is released.
+  bool ContinueLane(Lease& lease) {
+    if (lease.lane_ == Lease::kNoLane) {
+      return false;
+    }
+    if (lease.streak_ < batch_ && !lanes_[lease.lane_].items.empty()) {
+      return true;
+    }
+    ReleaseLane(lease);
+    return false;
+  }
+
+  // Give the lane of `lease` back with the lock held. A non-empty lane
+  // becomes ready again.
+  void ReleaseLane(Lease& lease) {
+    if (lease.lane_ == Lease::kNoLane) {
+      return;
+    }
+    Lane& lane = lanes_[lease.lane_];
+    lane.leased = false;
+    if (!lane.items.empty()) {
+      ready_.push_back(lease.lane_);
+      empty_cond_.notify_one();
+    }
+    lease.lane_ = Lease::kNoLane;
+  }
+
+  void LeaseReadyLane(Lease& lease) {
+    lease.lane_ = ready_.front();
+    lease.streak_ = 0;
+    ready_.pop_front();
+    assert(!lanes_[lease.lane_].leased);
+    lanes_[lease.lane_].leased = true;
+  }
+
+  void PopFrom(Lease& lease, T& result) {
+    Lane& lane = lanes_[lease.lane_];
+    assert(!lane.items.empty());
+    result = std::move(lane.items.front());
+    lane.items.pop_front();
+    --size_;
+    ++lease.streak_;
+  }
+
+  mutable std::mutex lock_;
+  std::condition_variable empty_cond_;
+  std::vector<Lane> lanes_;
+  // Lanes that are non-empty and not leased, in the order they became so.
+  std::deque<std::size_t> ready_;
+  std::size_t batch_;
+  std::size_t size_;
+  Hash hasher_;
+  bool finished_ = false;
+};
+
+}  // namespace fox_cq
@@ -0,0 +1,200 @@
+/**
+ * @author Hanwen Zheng
+ * @email eserinc.z@outlook.com
+ * @create date 2026-10-18 23:41:08
+ * @modify date 2026-10-18 23:41:08
+ * @desc A small pipeline of stages connected by limited size concurrent
+ * queues, running each stage on its own threads.
+ */
+#pragma once
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "concurrent_queue.h"
+
+namespace fox_cq {
+
+// Number of elements each queue between two stages holds before the stage in
+// front of it waits.
+static const std::size_t PipelineQueueSize = 256;
+
+template <typename T>
+class PipelineStage;
+
+namespace internal {
+
+// Elements carry their sequence number. Every queue holds consecutive
+// sequence numbers in increasing order, so a stage pops its input in order.
+template <typename T>
+using PipelineQueue =
+    ConcurrentQueue<std::pair<std::uint64_t, T>, PipelineQueueSize>;
+
+struct PipelineState {
+  // Thread bodies of the stages, started by `Sink`.
+  std::vector<std::function<void()>> tasks;
+};
+
+// Hands the results of a parallel stage to its output queue, renumbered in the
+// order they arrive, or in the order of the input if `ordered`.
+// Ordered results finishing early wait in a ring of `window` slots. A worker
+// whose result does not fit yet waits for the earlier results, so the buffer
+// stays bounded while the worker holding the next result never waits.
+template <typename T>
+class PipelineEmitter {
+ public:
+  PipelineEmitter(std::shared_ptr<PipelineQueue<T>> output, std::size_t window,
+                  bool ordered)
+      : output_(std::move(output)),
+        slots_(ordered ? window : 0),
+        ready_(ordered ? window : 0),
+        window_(window),
+        next_(0),
+        ordered_(ordered) {}
+
+  // Hand out the result of the input element numbered `seq`.
+  void Emit(std::uint64_t seq, T&& item) {
+    std::unique_lock<std::mutex> lk{lock_};
+    if (!ordered_) {
+      output_->Push(std::make_pair(next_++, std::move(item)));
+      return;
+    }
+    cond_.wait(lk, [this, seq] { return seq < next_ + window_; });
+    std::size_t index = seq % window_;
+    slots_[index] = std::move(item);
+    ready_[index] = true;
+    if (seq != next_) {
+      return;
+    }
+    // Flush every result that is now in order.
+    while (ready_[index]) {
+      ready_[index] = false;
+      output_->Push(std::make_pair(next_, std::move(slots_[index])));
+      index = ++next_ % window_;
+    }
+    cond_.notify_all();
+  }
+
+ private:
+  std::mutex lock_;
+  std::condition_variable cond_;
+  std::shared_ptr<PipelineQueue<T>> output_;
+  std::vector<T> slots_;
+  std::vector<bool> ready_;
+  const std::size_t window_;
+  // Sequence number of the next result to push.
+  std::uint64_t next_;
+  const bool ordered_;
+};
+
+}  // namespace internal
+
+// Builds a pipeline of a source, parallel map stages and a sink, e.g.
+//   Pipeline().Source<int>(read).ParallelMap(parse, 4).Sink(write);
+// Stages are connected by `ConcurrentQueue`s of `PipelineQueueSize`, so a slow
+// stage holds back the stages in front of it. Nothing runs until `Sink`.
+// Element types should be default constructible, and the functions should not
+// throw.
+class Pipeline {
+ public:
+  Pipeline() : state_(std::make_shared<internal::PipelineState>()) {}
+
+  // Start the pipeline with `fn`, a function `bool(T&)` called repeatedly on
+  // one thread to fill the next element, until it returns false at the end of
+  // the stream.
+  template <typename T, typename F>
+  PipelineStage<T> Source(F fn) {
+    std::shared_ptr<internal::PipelineQueue<T>> output =
+        std::make_shared<internal::PipelineQueue<T>>();
+    state_->tasks.emplace_back([fn, output]() mutable {
+      T item;
+      for (std::uint64_t seq = 0; fn(item); seq++) {
+        output->Push(std::make_pair(seq, std::move(item)));
+        item = T();
+      }
+      output->SetFinish();
+    });
+    return PipelineStage<T>(state_, std::move(output));
+  }
+
+ private:
+  std::shared_ptr<internal::PipelineState> state_;
+};
+
+// The output of a stage, to be followed by exactly one `ParallelMap` or
+// `Sink`.
+template <typename T>
+class PipelineStage {
+ public:
+  PipelineStage(std::shared_ptr<internal::PipelineState> state,
+                std::shared_ptr<internal::PipelineQueue<T>> input)
+      : state_(std::move(state)), input_(std::move(input)) {}
+
+  // Add a stage calling `fn`, a function `U(T&&)`, on `threads` threads. If
+  // `ordered`, results are passed on in the order of their input, keeping up
+  // to `4 * threads` results finished early. Otherwise they are passed on as
+  // soon as they are ready.
+  template <typename F,
+            typename U = typename std::decay<decltype(
+                std::declval<F&>()(std::declval<T&&>()))>::type>
+  PipelineStage<U> ParallelMap(F fn, std::size_t threads,
+                               bool ordered = true) {
+    assert(threads > 0);
+    std::shared_ptr<internal::PipelineQueue<U>> output =
+        std::make_shared<internal::PipelineQueue<U>>();
+    std::shared_ptr<internal::PipelineEmitter<U>> emitter =
+        std::make_shared<internal::PipelineEmitter<U>>(output, 4 * threads,
+                                                       ordered);
+    std::shared_ptr<std::atomic<std::size_t>> running =
+        std::make_shared<std::atomic<std::size_t>>(threads);
+    std::shared_ptr<internal::PipelineQueue<T>> input = input_;
+    for (std::size_t i = 0; i < threads; i++) {
+      state_->tasks.emplace_back(
+          [fn, input, output, emitter, running]() mutable {
+            std::pair<std::uint64_t, T> x;
+            while (input->Pop(x)) {
+              emitter->Emit(x.first, fn(std::move(x.second)));
+            }
+            // The last worker has emitted every result, end the stream.
+            if (--*running == 0) {
+              output->SetFinish();
+            }
+          });
+    }
+    return PipelineStage<U>(state_, std::move(output));
+  }
+
+  // Run the pipeline, calling `fn`, a function `void(T&&)`, with every element
+  // in the calling thread. Return when the end of the stream has passed
+  // through every stage.
+  template <typename F>
+  void Sink(F fn) {
+    std::vector<std::thread> threads;
+    std::vector<std::function<void()>> tasks;
+    tasks.swap(state_->tasks);
+    for (std::function<void()>& task : tasks) {
+      threads.emplace_back(std::move(task));
+    }
+    std::pair<std::uint64_t, T> x;
+    while (input_->Pop(x)) {
+      fn(std::move(x.second));
+    }
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+  }
+
+ private:
+  std::shared_ptr<internal::PipelineState> state_;
+  std::shared_ptr<internal::PipelineQueue<T>> input_;
+};
+
+}  // namespace fox_cq
@@ -0,0 +1,184 @@
+/**
+ * @author Hanwen Zheng
+ * @email eserinc.z@outlook.com
+ * @create date 2026-10-18 23:05:46
+ * @modify date 2026-10-19 10:12:37
+ * @desc A concurrent queue of owned objects returning spent objects to
+ * producers through a lock-free pool instead of freeing them.
+ */
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+#include "concurrent_queue.h"
+
+namespace fox_cq {
+
+namespace internal {
+
+// A lock-free ring of at most `capacity` pointers, allocated once. Each cell
+// has a sequence number telling whether it is free for the push at position
+// `pos` (`2 * pos`) or holds the element for the pop at `pos` (`2 * pos + 1`),
+// so producers and consumers only claim positions with compare-and-swap.
+template <typename T>
+class RecyclingPool {
+ public:
+  explicit RecyclingPool(std::size_t capacity)
+      : cells_(new Cell[capacity]), capacity_(capacity) {
+    for (std::size_t i = 0; i < capacity; i++) {
+      cells_[i].sequence.store(2 * i, std::memory_order_relaxed);
+    }
+    enqueue_pos_.store(0, std::memory_order_relaxed);
+    dequeue_pos_.store(0, std::memory_order_relaxed);
+  }
+  RecyclingPool(const RecyclingPool&) = delete;
+  RecyclingPool& operator=(const RecyclingPool&) = delete;
+
+  // Return false if the ring is full.
+  bool TryPush(T* item) {
+    std::size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    while (capacity_ > 0) {
+      Cell& cell = cells_[pos % capacity_];
+      std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+      if (sequence == 2 * pos) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+          cell.item = item;
+          cell.sequence.store(2 * pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (sequence < 2 * pos) {
+        // The cell still holds the element of the previous round.
+        return false;
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    return false;
+  }
+
+  // Return false if the ring is empty.
+  bool TryPop(T*& item) {
+    std::size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    while (capacity_ > 0) {
+      Cell& cell = cells_[pos % capacity_];
+      std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+      if (sequence == 2 * pos + 1) {
+        if (dequeue_pos_.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+          item = cell.item;
+          // Free for the push one round later.
+          cell.sequence.store(2 * (pos + capacity_), std::memory_order_release);
+          return true;
+        }
+      } else if (sequence < 2 * pos + 1) {
+        // Not pushed yet.
+        return false;
+      } else {
+        pos = dequeue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    return false;
+  }
+
+  // Return approximate number of pointers in the ring.
+  std::size_t Size() const {
+    std::size_t dequeue = dequeue_pos_.load(std::memory_order_relaxed);
+    std::size_t enqueue = enqueue_pos_.load(std::memory_order_relaxed);
+    return enqueue > dequeue ? enqueue - dequeue : 0;
+  }
+
+ private:
+  struct Cell {
+    std::atomic<std::size_t> sequence;
+    T* item;
+  };
+
+  std::unique_ptr<Cell[]> cells_;
+  const std::size_t capacity_;
+  // Producers and consumers update their positions on separate cache lines.
+  alignas(64) std::atomic<std::size_t> enqueue_pos_;
+  alignas(64) std::atomic<std::size_t> dequeue_pos_;
+};
+
+}  // namespace internal
+
+// A queue of `std::unique_ptr<T>` paired with a return path. Producers
+// `Acquire` an object, fill it and `Push` it, consumers `Pop` it and `Release`
+// it when done, so in a steady state objects go round without allocation.
+// Spent objects wait in a lock-free ring of `max_pooled` cells allocated at
+// construction, so releasing and acquiring neither allocate nor contend with
+// the lock of the forward queue. Objects released into a full ring are freed.
+// With a limited `MaxSize` the forward queue does not allocate either.
+// Recycled objects keep the state they were released with, producers should
+// overwrite what they use.
+template <typename T, std::size_t MaxSize = ConcurrentQueueUnlimitedSize>
+class RecyclingQueue {
+ public:
+  explicit RecyclingQueue(std::size_t max_pooled = 1024) : pool_(max_pooled) {}
+  RecyclingQueue(const RecyclingQueue&) = delete;
+  RecyclingQueue& operator=(const RecyclingQueue&) = delete;
+
+  // No other thread should use the queue any more.
+  ~RecyclingQueue() {
+    T* item;
+    while (pool_.TryPop(item)) {
+      delete item;
+    }
+  }
+
+  // Mark the queue has no more `Push` operation.
+  // `Push` operation after `SetFinish` will be ignored.
+  // Notice that `Pop` operation still works for remaining elements in the
+  // queue, and `Acquire` and `Release` keep working.
+  void SetFinish() { queue_.SetFinish(); }
+
+  // Return a recycled object, or a default constructed new one if none is
+  // pooled. (lock-free unless allocating)
+  std::unique_ptr<T> Acquire() {
+    T* item;
+    if (pool_.TryPop(item)) {
+      return std::unique_ptr<T>(item);
+    }
+    return std::unique_ptr<T>(new T());
+  }
+
+  // Give a spent object back for later `Acquire`. It is freed if the pool is
+  // full. (lock-free unless freeing)
+  void Release(std::unique_ptr<T> item) {
+    if (item && pool_.TryPush(item.get())) {
+      item.release();
+    }
+  }
+
+  // Move and push `item` into back of the queue, will wait for space when the
+  // queue has a limited size.
+  void Push(std::unique_ptr<T> item) { queue_.Push(std::move(item)); }
+
+  // Pop out the front element to `result`. (non-blocking, return immediately)
+  // Return true on success.
+  // Return false on failure (trying to
+  // pop from an empty queue).
+  bool TryPop(std::unique_ptr<T>& result) { return queue_.TryPop(result); }
+
+  // Pop out the front element to `result`, will wait for element to push.
+  // (blocking, may wait other thread to push new element)
+  // Return true on success.
+  // Return false on failure (trying to
+  // pop from a finished and empty queue).
+  bool Pop(std::unique_ptr<T>& result) { return queue_.Pop(result); }
+
+  // Return number of element in the queue
+  std::size_t Size() const { return queue_.Size(); }
+
+  // Return approximate number of objects waiting in the pool.
+  std::size_t Pooled() const { return pool_.Size(); }
+
+ private:
+  ConcurrentQueue<std::unique_ptr<T>, MaxSize> queue_;
+  internal::RecyclingPool<T> pool_;
+};
+
+}  // namespace fox_cq
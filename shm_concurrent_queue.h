@@ -0,0 +1,512 @@
+/**
+ * @author Hanwen Zheng
+ * @email eserinc.z@outlook.com
+ * @create date 2026-10-18 11:15:03
+ * @modify date 2026-10-18 11:15:03
+ * @desc A limited size concurrent queue shared between processes through a
+ * POSIX shared memory region, using process-shared pthread mutex and condition
+ * variables.
+ */
+#pragma once
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+
+namespace fox_cq {
+
+enum class ShmOpenMode {
+  // Create the shared memory region, fail if it already exists.
+  kCreate,
+  // Attach to a region created by another process.
+  kOpen,
+};
+
+// A limited size queue of trivially copyable `T` living in a shared memory
+// region named `name`, so processes on the same host can exchange elements
+// without sockets.
+// If a process attached to the queue dies, the queue is marked as finished and
+// `PeerCrashed` returns true, so no one waits for the dead process forever.
+// Peers are told apart by PID and start time, so a reused PID is not taken for
+// the dead peer. Only peers in the same PID namespace can be watched, the
+// death of a peer in another namespace is noticed only if it dies holding the
+// lock.
+// Operations throw std::system_error if the lock fails for any other reason.
+template <typename T, std::size_t MaxSize>
+class ShmConcurrentQueue {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "T should be trivially copyable to be shared between "
+                "processes");
+  static_assert(MaxSize > 0, "MaxSize should be positive");
+
+ public:
+  // Create or attach to the queue named `name`, which should start with '/'.
+  // Throw std::system_error if the region cannot be created or mapped, and
+  // std::runtime_error if it was created for another element type or size, or
+  // if 64 processes are attached to it already.
+  ShmConcurrentQueue(const std::string& name, ShmOpenMode mode)
+      : fd_(-1),
+        control_(nullptr),
+        peer_slot_(kMaxPeers),
+        pid_namespace_(PidNamespace()),
+        unrecoverable_(false) {
+    if (mode == ShmOpenMode::kCreate) {
+      Create(name);
+    } else {
+      Open(name);
+    }
+    if (!Lock()) {
+      return;
+    }
+    for (std::size_t i = 0; i < kMaxPeers; i++) {
+      if (control_->peers[i].pid == 0) {
+        pid_t pid = getpid();
+        control_->peers[i].pid = pid;
+        control_->peers[i].start_time = ProcessStartTime(pid);
+        control_->peers[i].pid_namespace = pid_namespace_;
+        peer_slot_ = i;
+        break;
+      }
+    }
+    Unlock();
+    if (peer_slot_ == kMaxPeers) {
+      // The death of this process would go unnoticed.
+      munmap(control_, sizeof(Control));
+      close(fd_);
+      throw std::runtime_error("too many processes attached to the queue");
+    }
+  }
+  ShmConcurrentQueue(const ShmConcurrentQueue&) = delete;
+  ShmConcurrentQueue& operator=(const ShmConcurrentQueue&) = delete;
+
+  // Detach from the queue. Other processes may still use it, so the queue is
+  // not finished and the region is not removed, see `Unlink`.
+  ~ShmConcurrentQueue() {
+    try {
+      if (peer_slot_ < kMaxPeers && Lock()) {
+        control_->peers[peer_slot_].pid = 0;
+        Unlock();
+      }
+    } catch (const std::system_error&) {
+      // Peers take this process for crashed once it exits.
+    }
+    munmap(control_, sizeof(Control));
+    close(fd_);
+  }
+
+  // Remove the name of the shared memory region. Attached processes keep
+  // working on it.
+  static void Unlink(const std::string& name) { shm_unlink(name.c_str()); }
+
+  // Mark the queue has no more `Push` operation.
+  // `Push` operation after `SetFinish` will be ignored.
+  // Notice that `Pop` operation still works for remaining elements in the
+  // queue.
+  void SetFinish() {
+    if (Lock()) {
+      control_->finished = true;
+      Unlock();
+    }
+    WakeupAll();
+  }
+
+  // Copy and push `item` into back of the queue, will wait for space.
+  // (blocking, may wait other process to pop)
+  void Push(const T& item) {
+    if (!Lock()) {
+      return;
+    }
+    while (control_->size == MaxSize && !control_->finished) {
+      if (!Wait(&control_->full_cond)) {
+        return;
+      }
+    }
+    if (control_->finished) {
+      Unlock();
+      // finished, should notify other processes to stop waiting.
+      WakeupAll();
+      return;
+    }
+    std::memcpy(Slot(control_->tail), &item, sizeof(T));
+    control_->tail = control_->tail < MaxSize - 1 ? control_->tail + 1 : 0;
+    ++control_->size;
+    bool full = control_->size == MaxSize;
+    Unlock();
+    if (!full) {
+      pthread_cond_signal(&control_->full_cond);
+    }
+    pthread_cond_signal(&control_->empty_cond);
+  }
+
+  // Pop out the front element to `result`. (non-blocking, return immediately)
+  // Return true on success.
+  // Return false on failure (trying to
+  // pop from an empty queue).
+  bool TryPop(T& result) {
+    if (!Lock()) {
+      return false;
+    }
+    if (control_->size == 0) {
+      Unlock();
+      return false;
+    }
+    PopFront(result);
+    Unlock();
+    pthread_cond_signal(&control_->full_cond);
+    return true;
+  }
+
+  // Pop out the front element to `result`, will wait for element to push.
+  // (blocking, may wait other process to push new element)
+  // Return true on success.
+  // Return false on failure (trying to
+  // pop from a finished and empty queue).
+  bool Pop(T& result) {
+    if (!Lock()) {
+      return false;
+    }
+    while (control_->size == 0 && !control_->finished) {
+      if (!Wait(&control_->empty_cond)) {
+        return false;
+      }
+    }
+    if (control_->size > 0) {
+      PopFront(result);
+      bool empty = control_->size == 0;
+      bool finished = control_->finished;
+      Unlock();
+      if (!empty) {
+        pthread_cond_signal(&control_->empty_cond);
+      } else if (finished) {
+        // finished, should notify other processes to stop waiting.
+        WakeupAll();
+        return true;
+      }
+      pthread_cond_signal(&control_->full_cond);
+      return true;
+    }
+    Unlock();
+    // finished, should notify other processes to stop waiting.
+    WakeupAll();
+    return false;
+  }
+
+  // Return number of element in the queue
+  std::size_t Size() const {
+    if (!Lock()) {
+      return 0;
+    }
+    std::size_t size = control_->size;
+    Unlock();
+    return size;
+  }
+
+  // Return true iff a process attached to the queue died, which also finishes
+  // the queue.
+  bool PeerCrashed() const {
+    if (!Lock()) {
+      // Only a peer dying with the lock held leaves it unrecoverable.
+      return true;
+    }
+    bool crashed = control_->peer_crashed;
+    Unlock();
+    return crashed;
+  }
+
+ private:
+  // Number of processes whose liveness is watched.
+  static const std::size_t kMaxPeers = 64;
+  // How often waiting processes check whether their peers are alive.
+  static const long kLivenessCheckIntervalNs = 100 * 1000 * 1000;
+  static const std::uint32_t kReady = 0x66637132;
+
+  // A process attached to the queue. `pid` is 0 for a free entry.
+  struct Peer {
+    pid_t pid;
+    // Start time of the process, 0 if unknown.
+    std::uint64_t start_time;
+    // Inode of the PID namespace of the process, 0 if unknown.
+    std::uint64_t pid_namespace;
+  };
+
+  // Everything shared between processes. The memory of a new region is zero
+  // filled, which is a valid empty state except for the pthread objects.
+  struct Control {
+    std::atomic<std::uint32_t> state;
+    std::uint32_t element_size;
+    std::uint64_t max_size;
+    pthread_mutex_t lock;
+    pthread_cond_t empty_cond;
+    pthread_cond_t full_cond;
+    std::size_t head;
+    std::size_t tail;
+    std::size_t size;
+    bool finished;
+    bool peer_crashed;
+    Peer peers[kMaxPeers];
+    alignas(T) unsigned char data[sizeof(T) * MaxSize];
+  };
+
+  void Create(const std::string& name) {
+    fd_ = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd_ < 0) {
+      throw std::system_error(errno, std::generic_category(), "shm_open");
+    }
+    if (ftruncate(fd_, sizeof(Control)) != 0) {
+      int error = errno;
+      close(fd_);
+      shm_unlink(name.c_str());
+      throw std::system_error(error, std::generic_category(), "ftruncate");
+    }
+    int error = Map();
+    if (error != 0) {
+      close(fd_);
+      shm_unlink(name.c_str());
+      throw std::system_error(error, std::generic_category(), "mmap");
+    }
+    control_->element_size = sizeof(T);
+    control_->max_size = MaxSize;
+
+    pthread_mutexattr_t mutex_attr;
+    pthread_mutexattr_init(&mutex_attr);
+    pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&mutex_attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&control_->lock, &mutex_attr);
+    pthread_mutexattr_destroy(&mutex_attr);
+
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setpshared(&cond_attr, PTHREAD_PROCESS_SHARED);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&control_->empty_cond, &cond_attr);
+    pthread_cond_init(&control_->full_cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+
+    control_->state.store(kReady, std::memory_order_release);
+  }
+
+  void Open(const std::string& name) {
+    fd_ = shm_open(name.c_str(), O_RDWR, 0600);
+    if (fd_ < 0) {
+      throw std::system_error(errno, std::generic_category(), "shm_open");
+    }
+    // The creator may not have sized or initialized the region yet.
+    struct stat st;
+    for (int retry = 0;; retry++) {
+      if (fstat(fd_, &st) != 0) {
+        int error = errno;
+        close(fd_);
+        throw std::system_error(error, std::generic_category(), "fstat");
+      }
+      if (static_cast<std::size_t>(st.st_size) >= sizeof(Control)) {
+        break;
+      }
+      if (st.st_size != 0 || retry == 1000) {
+        close(fd_);
+        throw std::runtime_error("shared memory region has wrong size");
+      }
+      usleep(1000);
+    }
+    int error = Map();
+    if (error != 0) {
+      close(fd_);
+      throw std::system_error(error, std::generic_category(), "mmap");
+    }
+    for (int retry = 0;
+         control_->state.load(std::memory_order_acquire) != kReady; retry++) {
+      if (retry == 1000) {
+        munmap(control_, sizeof(Control));
+        close(fd_);
+        throw std::runtime_error("shared memory region is not initialized");
+      }
+      usleep(1000);
+    }
+    if (control_->element_size != sizeof(T) || control_->max_size != MaxSize) {
+      munmap(control_, sizeof(Control));
+      close(fd_);
+      throw std::runtime_error(
+          "shared memory region holds a queue of another type");
+    }
+  }
+
+  // Return 0 on success, or the error number.
+  int Map() {
+    void* addr = mmap(nullptr, sizeof(Control), PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd_, 0);
+    if (addr == MAP_FAILED) {
+      return errno;
+    }
+    control_ = static_cast<Control*>(addr);
+    return 0;
+  }
+
+  // Return the start time of process `pid` in clock ticks since boot, or 0 if
+  // it does not exist or /proc is not available.
+  static std::uint64_t ProcessStartTime(pid_t pid) {
+    char path[64];
+    std::snprintf(path, sizeof(path), "/proc/%d/stat", static_cast<int>(pid));
+    std::FILE* file = std::fopen(path, "r");
+    if (!file) {
+      return 0;
+    }
+    char buffer[1024];
+    std::size_t len = std::fread(buffer, 1, sizeof(buffer) - 1, file);
+    std::fclose(file);
+    buffer[len] = '\0';
+    // The command name may contain anything, fields are counted after it.
+    const char* field = std::strrchr(buffer, ')');
+    if (!field) {
+      return 0;
+    }
+    // The start time is the 20th field after the command name.
+    for (int i = 0; i < 20 && field; i++) {
+      field = std::strchr(field + 1, ' ');
+    }
+    if (!field) {
+      return 0;
+    }
+    unsigned long long start_time = 0;
+    std::sscanf(field + 1, "%llu", &start_time);
+    return start_time;
+  }
+
+  // Return the inode of the PID namespace of this process, or 0 if unknown.
+  static std::uint64_t PidNamespace() {
+    struct stat st;
+    if (stat("/proc/self/ns/pid", &st) != 0) {
+      return 0;
+    }
+    return st.st_ino;
+  }
+
+  unsigned char* Slot(std::size_t index) const {
+    return control_->data + index * sizeof(T);
+  }
+
+  void PopFront(T& result) {
+    std::memcpy(&result, Slot(control_->head), sizeof(T));
+    control_->head = control_->head < MaxSize - 1 ? control_->head + 1 : 0;
+    --control_->size;
+  }
+
+  // Return true with the lock held, or false if the lock is not recoverable,
+  // which also finishes the queue for this process.
+  // Throw std::system_error if locking fails otherwise.
+  bool Lock() const {
+    if (unrecoverable_) {
+      return false;
+    }
+    int rc = pthread_mutex_lock(&control_->lock);
+    if (rc == EOWNERDEAD) {
+      Recover();
+    } else if (rc == ENOTRECOVERABLE) {
+      MarkUnrecoverable();
+      return false;
+    } else if (rc != 0) {
+      throw std::system_error(rc, std::generic_category(),
+                              "pthread_mutex_lock");
+    }
+    return true;
+  }
+
+  void Unlock() const { pthread_mutex_unlock(&control_->lock); }
+
+  // Wait on `cond` with the lock held, waking up periodically to check
+  // whether peers are still alive.
+  // Return false if the lock is not recoverable, in which case it is not held
+  // any more.
+  bool Wait(pthread_cond_t* cond) {
+    timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_nsec += kLivenessCheckIntervalNs;
+    if (deadline.tv_nsec >= 1000 * 1000 * 1000) {
+      deadline.tv_nsec -= 1000 * 1000 * 1000;
+      ++deadline.tv_sec;
+    }
+    int rc = pthread_cond_timedwait(cond, &control_->lock, &deadline);
+    if (rc == EOWNERDEAD) {
+      Recover();
+    } else if (rc == ENOTRECOVERABLE) {
+      MarkUnrecoverable();
+      return false;
+    } else if (rc == ETIMEDOUT) {
+      CheckPeers();
+    }
+    return true;
+  }
+
+  // The previous owner of the lock died while holding it. Indices are only
+  // updated after the element is copied, so the ring is still consistent,
+  // but the stream of elements is broken.
+  void Recover() const {
+    if (pthread_mutex_consistent(&control_->lock) != 0) {
+      return;
+    }
+    MarkPeerCrashed();
+  }
+
+  // The lock was left inconsistent by a process that died holding it, so it
+  // cannot be taken any more. Wake up other waiters of this process, which
+  // give up on their next attempt to lock.
+  void MarkUnrecoverable() const {
+    unrecoverable_ = true;
+    WakeupAll();
+  }
+
+  void CheckPeers() {
+    for (std::size_t i = 0; i < kMaxPeers; i++) {
+      Peer& peer = control_->peers[i];
+      if (peer.pid == 0 || peer.pid_namespace != pid_namespace_) {
+        // The PID of a peer in another namespace means nothing here.
+        continue;
+      }
+      bool dead;
+      if (peer.start_time != 0) {
+        // Another process may have been given the PID of the dead peer.
+        dead = ProcessStartTime(peer.pid) != peer.start_time;
+      } else {
+        dead = kill(peer.pid, 0) != 0 && errno == ESRCH;
+      }
+      if (dead) {
+        peer.pid = 0;
+        MarkPeerCrashed();
+      }
+    }
+  }
+
+  // Called with the lock held.
+  void MarkPeerCrashed() const {
+    control_->peer_crashed = true;
+    control_->finished = true;
+    WakeupAll();
+  }
+
+  void WakeupAll() const {
+    pthread_cond_broadcast(&control_->empty_cond);
+    pthread_cond_broadcast(&control_->full_cond);
+  }
+
+  int fd_;
+  Control* control_;
+  // Index of this process in `Control::peers`, `kMaxPeers` if not watched.
+  std::size_t peer_slot_;
+  const std::uint64_t pid_namespace_;
+  // Set once the lock is found unrecoverable.
+  mutable std::atomic<bool> unrecoverable_;
+};
+
+}  // namespace fox_cq
@@ -0,0 +1,291 @@
+/**
+ * @author Hanwen Zheng
+ * @email eserinc.z@outlook.com
+ * @create date 2026-10-18 13:40:27
+ * @modify date 2026-10-18 13:40:27
+ * @desc An unlimited size concurrent queue keeping a bounded number of
+ * elements in memory and spilling the rest to a local file.
+ */
+#pragma once
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+#include "concurrent_queue.h"
+
+namespace fox_cq {
+
+// How to write an element to the spill file and read it back.
+// Specialize it for types that are not trivially copyable. Return false on
+// I/O failure.
+template <typename T, typename Enable = void>
+struct SpillSerializer;
+
+template <typename T>
+struct SpillSerializer<
+    T, typename std::enable_if<std::is_trivially_copyable<T>::value>::type> {
+  static bool Write(std::FILE* file, const T& value) {
+    return std::fwrite(&value, sizeof(T), 1, file) == 1;
+  }
+  static bool Read(std::FILE* file, T& value) {
+    return std::fread(&value, sizeof(T), 1, file) == 1;
+  }
+};
+
+template <>
+struct SpillSerializer<std::string> {
+  static bool Write(std::FILE* file, const std::string& value) {
+    std::uint64_t size = value.size();
+    return std::fwrite(&size, sizeof(size), 1, file) == 1 &&
+           std::fwrite(value.data(), 1, value.size(), file) == value.size();
+  }
+  static bool Read(std::FILE* file, std::string& value) {
+    std::uint64_t size;
+    if (std::fread(&size, sizeof(size), 1, file) != 1) {
+      return false;
+    }
+    value.resize(size);
+    return std::fread(&value[0], 1, size, file) == size;
+  }
+};
+
+struct SpillOptions {
+  // Number of elements kept in memory before later ones are spilled.
+  std::size_t memory_threshold = 65536;
+  // Number of elements written to or read from the spill file at once.
+  std::size_t batch_size = 1024;
+  // Directory of the spill file. The file is unlinked right after creation,
+  // so it disappears with the process.
+  std::string directory = "/tmp";
+  // Called with the error when the spill file cannot be created, written or
+  // read, and the number of spilled elements lost with it. Elements failing
+  // to be written stay in memory and are spilled again a batch later, so
+  // only a read failure loses elements.
+  // It runs with the lock of the queue held and should not use the queue.
+  std::function<void(std::error_code error, std::size_t lost)> on_error;
+};
+
+// A container for `ConcurrentQueue` that keeps the front and the back of the
+// queue in memory, and the middle in an append-only file read back in order.
+// Elements are written and read in batches, so the file is accessed
+// sequentially.
+template <typename T, typename Serializer = SpillSerializer<T>>
+class SpillingContainer {
+ public:
+  explicit SpillingContainer(SpillOptions options = SpillOptions())
+      : options_(std::move(options)),
+        file_(nullptr),
+        spilled_(0),
+        read_offset_(0),
+        write_offset_(0),
+        spill_at_(options_.batch_size) {
+    assert(options_.batch_size > 0);
+  }
+  SpillingContainer(const SpillingContainer&) = delete;
+  SpillingContainer(SpillingContainer&& other) { MoveFrom(other); }
+  SpillingContainer& operator=(const SpillingContainer&) = delete;
+  SpillingContainer& operator=(SpillingContainer&& other) {
+    if (this != &other) {
+      Close();
+      MoveFrom(other);
+    }
+    return *this;
+  }
+  ~SpillingContainer() { Close(); }
+
+  // If the spill file cannot be created or written, the elements are kept in
+  // memory and spilling is tried again a batch later.
+  template <typename U>
+  void Push(U&& value) {
+    if (spilled_ == 0 && tail_.empty() &&
+        head_.size() < options_.memory_threshold) {
+      head_.push_back(std::forward<U>(value));
+      return;
+    }
+    tail_.push_back(std::forward<U>(value));
+    if (tail_.size() >= spill_at_) {
+      Spill();
+    }
+  }
+
+  void Push() { Push(T()); }
+
+  void Pop(T& value) {
+    Refill();
+    value = std::move(head_.front());
+    head_.pop_front();
+    ReadBack();
+  }
+
+  void Pop() {
+    Refill();
+    head_.pop_front();
+    ReadBack();
+  }
+
+  std::size_t Size() const { return head_.size() + spilled_ + tail_.size(); }
+
+  bool Empty() const { return Size() == 0; }
+
+  bool Full() const { return false; }
+
+  // Return number of elements in the spill file.
+  std::size_t SpilledSize() const { return spilled_; }
+
+ private:
+  void MoveFrom(SpillingContainer& other) {
+    options_ = std::move(other.options_);
+    head_ = std::move(other.head_);
+    tail_ = std::move(other.tail_);
+    file_ = other.file_;
+    spilled_ = other.spilled_;
+    read_offset_ = other.read_offset_;
+    write_offset_ = other.write_offset_;
+    spill_at_ = other.spill_at_;
+    other.file_ = nullptr;
+    other.spilled_ = 0;
+    other.head_.clear();
+    other.tail_.clear();
+  }
+
+  void Close() {
+    if (file_) {
+      std::fclose(file_);
+      file_ = nullptr;
+    }
+  }
+
+  // Return 0 on success, or the error number.
+  int OpenFile() {
+    std::string path = options_.directory + "/fox_cq_spill_XXXXXX";
+    int fd = mkstemp(&path[0]);
+    if (fd < 0) {
+      return errno;
+    }
+    unlink(path.c_str());
+    file_ = fdopen(fd, "w+b");
+    if (!file_) {
+      int error = errno;
+      close(fd);
+      return error;
+    }
+    return 0;
+  }
+
+  void ReportError(int error, std::size_t lost) {
+    if (options_.on_error) {
+      // Some failures, e.g. a short read at the end of the file, leave errno
+      // untouched.
+      options_.on_error(std::error_code(error != 0 ? error : EIO,
+                                        std::generic_category()),
+                        lost);
+    }
+  }
+
+  // Append the elements at the back to the spill file. On failure they stay
+  // at the back, and the next try is a batch later.
+  void Spill() {
+    errno = 0;
+    bool failed = !file_ && OpenFile() != 0;
+    failed = failed || std::fseek(file_, write_offset_, SEEK_SET) != 0;
+    for (auto it = tail_.begin(); !failed && it != tail_.end(); ++it) {
+      failed = !Serializer::Write(file_, *it);
+    }
+    failed = failed || std::fflush(file_) != 0;
+    if (failed) {
+      int error = errno;
+      if (file_) {
+        // What was written after `write_offset_` is overwritten next time.
+        std::clearerr(file_);
+      }
+      spill_at_ = tail_.size() + options_.batch_size;
+      ReportError(error, 0);
+      return;
+    }
+    write_offset_ = std::ftell(file_);
+    spilled_ += tail_.size();
+    tail_.clear();
+    spill_at_ = options_.batch_size;
+  }
+
+  // Make sure the front element is in memory.
+  void Refill() {
+    assert(!Empty());
+    if (head_.empty()) {
+      // Spilled elements are read back as soon as `head_` is drained.
+      assert(spilled_ == 0);
+      head_.swap(tail_);
+    }
+  }
+
+  // Read back the next batch of the spill file once `head_` is drained, so
+  // an unreadable file is noticed before the queue counts its elements.
+  // Elements that cannot be read are dropped and reported.
+  void ReadBack() {
+    if (!head_.empty() || spilled_ == 0) {
+      return;
+    }
+    std::size_t n =
+        spilled_ < options_.batch_size ? spilled_ : options_.batch_size;
+    errno = 0;
+    bool failed = std::fseek(file_, read_offset_, SEEK_SET) != 0;
+    std::size_t read = 0;
+    for (; !failed && read < n; read++) {
+      T value;
+      if (!Serializer::Read(file_, value)) {
+        failed = true;
+        break;
+      }
+      head_.push_back(std::move(value));
+    }
+    int error = errno;
+    read_offset_ = std::ftell(file_);
+    spilled_ -= read;
+    if (failed) {
+      // The rest of the file cannot be trusted.
+      std::size_t lost = spilled_;
+      spilled_ = 0;
+      std::clearerr(file_);
+      ReportError(error, lost);
+    }
+    if (spilled_ == 0) {
+      // Everything is read back, reuse the file from the beginning.
+      read_offset_ = write_offset_ = 0;
+      // Failing to shrink only keeps stale content, which is overwritten.
+      int rc = ftruncate(fileno(file_), 0);
+      (void)rc;
+    }
+  }
+
+  SpillOptions options_;
+  // Front of the queue.
+  std::deque<T> head_;
+  // Back of the queue, waiting to be spilled once a batch is full.
+  std::deque<T> tail_;
+  std::FILE* file_;
+  // Number of elements in the file, between `head_` and `tail_`.
+  std::size_t spilled_;
+  long read_offset_;
+  long write_offset_;
+  // Size of `tail_` at which to spill, raised after a failure to write.
+  std::size_t spill_at_;
+};
+
+// An unlimited size queue keeping at most about
+// `memory_threshold + 2 * batch_size` elements in memory.
+template <typename T, typename Serializer = SpillSerializer<T>>
+using SpillingConcurrentQueue =
+    ConcurrentQueue<T, ConcurrentQueueUnlimitedSize,
+                    SpillingContainer<T, Serializer>>;
+
+}  // namespace fox_cq
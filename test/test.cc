@@ -5,15 +5,33 @@
  * @modify date 2024-05-08 09:12:24
  * @desc Some tests for concurrent queue.
  */
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <atomic>
 #include <iostream>
 #include <memory>
 #include <optional>
 #include <random>
 #include <set>
+#include <string>
 #include <thread>
 
+#include "../broadcast_queue.h"
+#include "../codel_queue.h"
+#include "../concurrent_byte_queue.h"
 #include "../concurrent_queue.h"
+#include "../conflating_queue.h"
+#include "../delay_queue.h"
+#include "../fair_queue.h"
+#include "../lock_free_queue.h"
+#include "../partitioned_queue.h"
+#include "../pipeline.h"
+#include "../recycling_queue.h"
+#include "../shm_concurrent_queue.h"
+#include "../spilling_queue.h"
 #define CATCH_CONFIG_MAIN
 #include "../third_party/catch.hpp"
 
@@ -476,3 +494,1243 @@ TEST_CASE("Medium parallel test for unlimited size concurrent queue",
   }
   REQUIRE(in == out);
 }
+
+TEST_CASE("Zero capacity concurrent queue hands elements over",
+          "<int, ZeroSize>[Parallel]") {
+  ConcurrentQueue<std::unique_ptr<int>, 0> q;
+  std::unique_ptr<int> x;
+  REQUIRE(!q.TryPop(x));
+
+  std::atomic<bool> pushed{false};
+  std::thread producer([&] {
+    q.Push(std::unique_ptr<int>(new int(1)));
+    pushed = true;
+  });
+  // The producer waits for a consumer.
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  REQUIRE(!pushed);
+  REQUIRE(q.Size() == 1);
+  REQUIRE(q.Pop(x));
+  REQUIRE(*x == 1);
+  producer.join();
+  REQUIRE(pushed);
+
+  std::thread consumer([&] { q.Pop(x); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  q.Push(std::unique_ptr<int>(new int(2)));
+  consumer.join();
+  REQUIRE(*x == 2);
+
+  q.SetFinish();
+  REQUIRE(!q.Pop(x));
+}
+
+TEST_CASE("Parallel test for zero capacity concurrent queue",
+          "<int, ZeroSize>[Parallel]") {
+  const int size = 20000;
+  ConcurrentQueue<int, 0> q;
+  const int nthreadput = 4;
+  const int nthreadget = 4;
+
+  std::vector<std::thread> threads;
+  std::atomic<int> completed_put{0};
+  for (int i = 0; i < nthreadput; i++) {
+    int l = i * size / nthreadput;
+    int r = (i + 1) * size / nthreadput;
+    threads.emplace_back(
+        [&](int l, int r) {
+          for (int i = l; i < r; i++) {
+            q.Push(i);
+          }
+          if (++completed_put == nthreadput) {
+            q.SetFinish();
+          }
+        },
+        l, r);
+  }
+  std::vector<std::vector<int>> collections(nthreadget);
+  for (int i = 0; i < nthreadget; i++) {
+    threads.emplace_back(
+        [&](int id) {
+          int x;
+          while (q.Pop(x)) {
+            collections[id].push_back(x);
+          }
+        },
+        i);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  std::set<int> out;
+  for (const auto& collection : collections) {
+    out.insert(collection.begin(), collection.end());
+  }
+  // Every push returns after its element is taken, so none is lost.
+  REQUIRE(out.size() == size);
+}
+
+TEST_CASE("Watermarks of limited sized concurrent queue",
+          "<int, LimitedSize>(watermark)[Parallel]") {
+  ConcurrentQueue<int, 16> q;
+  int highs = 0;
+  int lows = 0;
+  q.SetWatermarks(12, 4, [&highs] { ++highs; }, [&lows] { ++lows; });
+  for (int i = 0; i < 12; i++) {
+    q.Push(i);
+  }
+  REQUIRE(highs == 1);
+
+  // Producers wait from the high watermark until the low watermark.
+  std::atomic<bool> pushed{false};
+  std::thread producer([&] {
+    q.Push(12);
+    pushed = true;
+  });
+  int x;
+  for (int i = 0; i < 7; i++) {
+    REQUIRE(q.Pop(x));
+    REQUIRE(x == i);
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  REQUIRE(!pushed);
+  REQUIRE(lows == 0);
+  REQUIRE(q.Pop(x));
+  producer.join();
+  REQUIRE(pushed);
+  REQUIRE(lows == 1);
+  REQUIRE(q.Size() == 5);
+
+  // Disabled watermarks only wait for free slots.
+  q.SetWatermarks(0, 0);
+  for (int i = 0; i < 11; i++) {
+    q.Push(13 + i);
+  }
+  REQUIRE(q.Size() == 16);
+  REQUIRE(highs == 1);
+
+  // Bulk pushes stop at the high watermark too.
+  int drained[16];
+  REQUIRE(q.TryPopBulk(drained, 16) == 16);
+  q.SetWatermarks(8, 2);
+  std::thread bulk_producer([&q] {
+    int items[10] = {};
+    q.PushBulk(items, 10);
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  REQUIRE(q.Size() == 8);
+  REQUIRE(q.TryPopBulk(drained, 16) == 8);
+  bulk_producer.join();
+  REQUIRE(q.Size() == 2);
+}
+
+TEST_CASE("Reserve and commit slots in limited sized concurrent queue",
+          "<int, LimitedSize>(reserve)") {
+  ConcurrentQueue<int, 5> q;
+  q.Push(0);
+  q.Push(1);
+  q.Push(2);
+  int x;
+  REQUIRE(q.Pop(x));
+  REQUIRE(q.Pop(x));
+
+  // Tail is at slot 3, so the four slots wrap around.
+  auto reservation = q.Reserve(4);
+  REQUIRE(reservation.Size() == 4);
+  REQUIRE(reservation.first.size == 2);
+  REQUIRE(reservation.second.size == 2);
+  for (std::size_t i = 0; i < reservation.Size(); i++) {
+    reservation[i] = 10 + static_cast<int>(i);
+  }
+  REQUIRE(q.Size() == 1);
+  q.Commit(3);
+  REQUIRE(q.Size() == 4);
+  // Nothing is reserved any more.
+  q.Commit(1);
+  REQUIRE(q.Size() == 4);
+
+  REQUIRE(q.Pop(x));
+  REQUIRE(x == 2);
+  for (int i = 0; i < 3; i++) {
+    REQUIRE(q.Pop(x));
+    REQUIRE(x == 10 + i);
+  }
+
+  // Never fits, so it does not wait.
+  REQUIRE(q.Reserve(6).Empty());
+  // Committing more than reserved only publishes the reservation.
+  reservation = q.Reserve(2);
+  reservation[0] = 20;
+  reservation[1] = 21;
+  q.Commit(3);
+  REQUIRE(q.Size() == 2);
+  REQUIRE(q.Pop(x));
+  REQUIRE(x == 20);
+  REQUIRE(q.Pop(x));
+  REQUIRE(x == 21);
+
+  q.SetFinish();
+  REQUIRE(q.Reserve(1).Empty());
+  q.Commit(1);
+  REQUIRE(q.Size() == 0);
+}
+
+TEST_CASE("Parallel reserve and commit in limited sized concurrent queue",
+          "<int, LimitedSize>(reserve)[Parallel]") {
+  const int size = 100000;
+  const int batch = 7;
+  ConcurrentQueue<int, 16> q;
+  std::thread producer([&] {
+    int next = 0;
+    while (next < size) {
+      int n = std::min(batch, size - next);
+      auto reservation = q.Reserve(n);
+      for (int i = 0; i < n; i++) {
+        reservation[i] = next++;
+      }
+      q.Commit(n);
+    }
+    q.SetFinish();
+  });
+  int x;
+  int expected = 0;
+  bool ordered = true;
+  while (q.Pop(x)) {
+    ordered = ordered && x == expected;
+    ++expected;
+  }
+  producer.join();
+  REQUIRE(ordered);
+  REQUIRE(expected == size);
+}
+
+TEST_CASE("Parallel bulk push and pop in limited sized concurrent queue",
+          "<int, LimitedSize>(bulk)[Parallel]") {
+  const int size = 100000;
+  ConcurrentQueue<int, 64> q;
+  bool complete = true;
+  std::thread producer([&] {
+    // Batches larger than the queue are pushed in chunks.
+    std::vector<int> batch(100);
+    for (int next = 0; next < size; next += 100) {
+      for (int i = 0; i < 100; i++) {
+        batch[i] = next + i;
+      }
+      complete =
+          complete && q.PushBulk(batch.data(), batch.size()) == batch.size();
+    }
+    q.SetFinish();
+    complete = complete && q.PushBulk(batch.data(), batch.size()) == 0;
+  });
+  std::vector<int> out;
+  int buffer[37];
+  while (std::size_t n = q.PopBulk(buffer, 37)) {
+    out.insert(out.end(), buffer, buffer + n);
+  }
+  producer.join();
+  REQUIRE(complete);
+  REQUIRE(q.TryPopBulk(buffer, 37) == 0);
+  bool ordered = true;
+  for (int i = 0; i < static_cast<int>(out.size()); i++) {
+    ordered = ordered && out[i] == i;
+  }
+  REQUIRE(ordered);
+  REQUIRE(out.size() == size);
+}
+
+TEST_CASE("Variable length records in concurrent byte queue",
+          "<ConcurrentByteQueue>") {
+  ConcurrentByteQueue<64> q;
+  REQUIRE(q.PushBytes("hello", 5));
+  REQUIRE(q.PushBytes("", 0));
+  REQUIRE(q.PushBytes("concurrent", 10));
+  REQUIRE(!q.PushBytes(std::string(100, 'x').data(), 100));
+  REQUIRE(q.Size() == 3);
+
+  ConcurrentByteQueue<64>::ByteView view;
+  REQUIRE(q.PopBytes(view));
+  REQUIRE(std::string(reinterpret_cast<const char*>(view.Data()),
+                      view.Size()) == "hello");
+  {
+    ConcurrentByteQueue<64>::ByteView empty;
+    REQUIRE(q.TryPopBytes(empty));
+    REQUIRE(empty.Size() == 0);
+  }
+  // The first record is still held by `view`, so its space is not reclaimed
+  // even though the one after it has been released.
+  REQUIRE(q.UsedBytes() == 16 + 8 + 24);
+  view.Release();
+  REQUIRE(q.UsedBytes() == 24);
+
+  // Wraps around the end of the buffer.
+  REQUIRE(q.PushBytes("0123456789abcdef", 16));
+  REQUIRE(q.Size() == 2);
+  REQUIRE(q.UsedBytes() == 64);
+  REQUIRE(q.PopBytes(view));
+  REQUIRE(view.Size() == 10);
+  REQUIRE(q.PopBytes(view));
+  REQUIRE(std::string(reinterpret_cast<const char*>(view.Data()),
+                      view.Size()) == "0123456789abcdef");
+  view.Release();
+  REQUIRE(q.UsedBytes() == 0);
+
+  q.SetFinish();
+  REQUIRE(!q.PushBytes("late", 4));
+  REQUIRE(!q.PopBytes(view));
+}
+
+TEST_CASE("Byte queue reader skips wrap padding reclaimed under it",
+          "<ConcurrentByteQueue>") {
+  ConcurrentByteQueue<64> q;
+  ConcurrentByteQueue<64>::ByteView a, b, view;
+  REQUIRE(q.PushBytes("aaaaaaaaaaaaaaaa", 16));
+  REQUIRE(q.PushBytes("bbbbbbbbbbbbbbbb", 16));
+  REQUIRE(q.PopBytes(a));
+  REQUIRE(q.PopBytes(b));
+  a.Release();
+  // Does not fit before the end, so padding is written at the position of
+  // the reader and the record goes to the beginning.
+  REQUIRE(q.PushBytes("cccccccccccccccc", 16));
+  REQUIRE(q.UsedBytes() == 24 + 16 + 24);
+  // Reclaims the padding while the reader is still on it.
+  b.Release();
+  REQUIRE(q.UsedBytes() == 24);
+  // Overwrites the bytes of the reclaimed padding.
+  REQUIRE(q.PushBytes("dddddddddddddddddddddddd", 24));
+
+  REQUIRE(q.TryPopBytes(view));
+  REQUIRE(std::string(reinterpret_cast<const char*>(view.Data()),
+                      view.Size()) == "cccccccccccccccc");
+  REQUIRE(q.TryPopBytes(view));
+  REQUIRE(std::string(reinterpret_cast<const char*>(view.Data()),
+                      view.Size()) == "dddddddddddddddddddddddd");
+  view.Release();
+  REQUIRE(q.UsedBytes() == 0);
+  REQUIRE(!q.TryPopBytes(view));
+}
+
+TEST_CASE("Parallel test for concurrent byte queue",
+          "<ConcurrentByteQueue>[Parallel]") {
+  const int size = 100000;
+  ConcurrentByteQueue<256> q;
+  const int nthreadput = 4;
+  const int nthreadget = 4;
+
+  std::vector<std::thread> threads;
+  std::atomic<int> completed_put{0};
+  for (int i = 0; i < nthreadput; i++) {
+    int l = i * size / nthreadput;
+    int r = (i + 1) * size / nthreadput;
+    threads.emplace_back(
+        [&](int l, int r) {
+          for (int i = l; i < r; i++) {
+            // Records of 1 to 5 integers.
+            int record[5] = {i, i, i, i, i};
+            q.PushBytes(record, sizeof(int) * (i % 5 + 1));
+          }
+          if (++completed_put == nthreadput) {
+            q.SetFinish();
+          }
+        },
+        l, r);
+  }
+  std::vector<std::vector<int>> collections(nthreadget);
+  std::atomic<bool> intact{true};
+  for (int i = 0; i < nthreadget; i++) {
+    threads.emplace_back(
+        [&](int id) {
+          ConcurrentByteQueue<256>::ByteView view;
+          while (q.PopBytes(view)) {
+            int record[5];
+            std::memcpy(record, view.Data(), view.Size());
+            if (view.Size() != sizeof(int) * (record[0] % 5 + 1) ||
+                record[view.Size() / sizeof(int) - 1] != record[0]) {
+              intact = false;
+            }
+            collections[id].push_back(record[0]);
+          }
+        },
+        i);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  REQUIRE(intact);
+  std::multiset<int> out;
+  for (int i = 0; i < nthreadget; i++) {
+    out.insert(collections[i].begin(), collections[i].end());
+  }
+  REQUIRE(out.size() == size);
+  REQUIRE(*out.begin() == 0);
+  REQUIRE(*out.rbegin() == size - 1);
+}
+
+TEST_CASE("Parallel test for shared memory concurrent queue",
+          "<ShmConcurrentQueue>[Parallel]") {
+  const int size = 100000;
+  const std::string name = "/fox_cq_test_" + std::to_string(getpid());
+  ShmConcurrentQueue<int, 20>::Unlink(name);
+  ShmConcurrentQueue<int, 20> producer_side(name, ShmOpenMode::kCreate);
+  // Another mapping of the same region, as another process would have.
+  ShmConcurrentQueue<int, 20> consumer_side(name, ShmOpenMode::kOpen);
+  ShmConcurrentQueue<int, 20>::Unlink(name);
+
+  std::thread producer([&] {
+    for (int i = 0; i < size; i++) {
+      producer_side.Push(i);
+    }
+    producer_side.SetFinish();
+  });
+  int x;
+  int expected = 0;
+  bool ordered = true;
+  while (consumer_side.Pop(x)) {
+    ordered = ordered && x == expected;
+    ++expected;
+  }
+  producer.join();
+  REQUIRE(ordered);
+  REQUIRE(expected == size);
+  REQUIRE(!consumer_side.PeerCrashed());
+}
+
+TEST_CASE("Shared memory concurrent queue finishes when a peer dies",
+          "<ShmConcurrentQueue>") {
+  const std::string name = "/fox_cq_test_" + std::to_string(getpid());
+  ShmConcurrentQueue<int, 4>::Unlink(name);
+  ShmConcurrentQueue<int, 4> q(name, ShmOpenMode::kCreate);
+  pid_t pid = fork();
+  if (pid == 0) {
+    ShmConcurrentQueue<int, 4> child(name, ShmOpenMode::kOpen);
+    child.Push(42);
+    // Exit without detaching, as if crashed.
+    _exit(0);
+  }
+  waitpid(pid, nullptr, 0);
+  ShmConcurrentQueue<int, 4>::Unlink(name);
+
+  int x;
+  REQUIRE(q.Pop(x));
+  REQUIRE(x == 42);
+  REQUIRE(!q.Pop(x));
+  REQUIRE(q.PeerCrashed());
+}
+
+TEST_CASE("Shared memory concurrent queue refuses peers beyond its table",
+          "<ShmConcurrentQueue>") {
+  using Queue = ShmConcurrentQueue<int, 4>;
+  const std::string name = "/fox_cq_test_" + std::to_string(getpid());
+  Queue::Unlink(name);
+  Queue q(name, ShmOpenMode::kCreate);
+  std::vector<std::unique_ptr<Queue>> peers;
+  for (int i = 1; i < 64; i++) {
+    peers.emplace_back(new Queue(name, ShmOpenMode::kOpen));
+  }
+  REQUIRE_THROWS_AS(Queue(name, ShmOpenMode::kOpen), std::runtime_error);
+  // A detached peer frees its entry.
+  peers.pop_back();
+  Queue last(name, ShmOpenMode::kOpen);
+  Queue::Unlink(name);
+  REQUIRE(!q.PeerCrashed());
+}
+
+TEST_CASE("Spilling concurrent queue keeps order across the spill file",
+          "<std::string, Spilling>") {
+  SpillOptions options;
+  options.memory_threshold = 8;
+  options.batch_size = 4;
+  SpillingConcurrentQueue<std::string> q{
+      SpillingContainer<std::string>(options)};
+  for (int i = 0; i < 100; i++) {
+    q.Push(std::to_string(i));
+  }
+  REQUIRE(q.Size() == 100);
+  std::string s;
+  for (int i = 0; i < 50; i++) {
+    REQUIRE(q.Pop(s));
+    REQUIRE(s == std::to_string(i));
+  }
+  for (int i = 100; i < 150; i++) {
+    q.Push(std::to_string(i));
+  }
+  q.SetFinish();
+  for (int i = 50; i < 150; i++) {
+    REQUIRE(q.Pop(s));
+    REQUIRE(s == std::to_string(i));
+  }
+  REQUIRE(!q.Pop(s));
+}
+
+TEST_CASE("Parallel test for spilling concurrent queue",
+          "<int, Spilling>[Parallel]") {
+  const int size = 100000;
+  SpillOptions options;
+  options.memory_threshold = 1000;
+  options.batch_size = 256;
+  SpillingConcurrentQueue<int> q{SpillingContainer<int>(options)};
+  std::thread producer([&] {
+    for (int i = 0; i < size; i++) {
+      q.Push(i);
+    }
+    q.SetFinish();
+  });
+  int x;
+  int expected = 0;
+  bool ordered = true;
+  while (q.Pop(x)) {
+    ordered = ordered && x == expected;
+    ++expected;
+  }
+  producer.join();
+  REQUIRE(ordered);
+  REQUIRE(expected == size);
+}
+
+// Fails to read back the element 5.
+struct FlakySerializer {
+  static bool Write(std::FILE* file, const int& value) {
+    return SpillSerializer<int>::Write(file, value);
+  }
+  static bool Read(std::FILE* file, int& value) {
+    return SpillSerializer<int>::Read(file, value) && value != 5;
+  }
+};
+
+TEST_CASE("Spilling concurrent queue survives spill file failures",
+          "<int, Spilling>") {
+  std::vector<std::size_t> errors;
+  SpillOptions options;
+  options.memory_threshold = 2;
+  options.batch_size = 2;
+  options.on_error = [&](std::error_code, std::size_t lost) {
+    errors.push_back(lost);
+  };
+
+  // The spill file cannot be created, elements stay in memory.
+  options.directory = "/nonexistent/fox_cq";
+  SpillingConcurrentQueue<int> in_memory{SpillingContainer<int>(options)};
+  for (int i = 0; i < 10; i++) {
+    in_memory.Push(i);
+  }
+  REQUIRE(in_memory.Size() == 10);
+  // Tried again every batch, nothing is lost.
+  REQUIRE(errors == std::vector<std::size_t>(4, 0));
+  int x;
+  for (int i = 0; i < 10; i++) {
+    REQUIRE(in_memory.TryPop(x));
+    REQUIRE(x == i);
+  }
+
+  // Elements after an unreadable one are dropped, never handed out.
+  errors.clear();
+  options.directory = "/tmp";
+  SpillingConcurrentQueue<int, FlakySerializer> flaky{
+      SpillingContainer<int, FlakySerializer>(options)};
+  for (int i = 0; i < 10; i++) {
+    flaky.Push(i);
+  }
+  for (int i = 0; i < 5; i++) {
+    REQUIRE(flaky.TryPop(x));
+    REQUIRE(x == i);
+  }
+  REQUIRE(errors == std::vector<std::size_t>{5});
+  REQUIRE(flaky.Size() == 0);
+  flaky.SetFinish();
+  REQUIRE(!flaky.Pop(x));
+}
+
+TEST_CASE("Readiness notifier of concurrent queue follows emptiness",
+          "<int, UnlimitedSize>(eventfd)") {
+  ConcurrentQueue<int> q;
+  REQUIRE(q.NativeHandle() == -1);
+  int fd = q.EnableReadinessNotifier();
+  REQUIRE(fd >= 0);
+  REQUIRE(q.NativeHandle() == fd);
+  auto readable = [fd] {
+    pollfd pfd{fd, POLLIN, 0};
+    return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN);
+  };
+
+  REQUIRE(!readable());
+  q.Push(1);
+  REQUIRE(readable());
+  q.Push(2);
+  int x;
+  REQUIRE(q.TryPop(x));
+  REQUIRE(readable());
+  REQUIRE(q.Pop(x));
+  REQUIRE(!readable());
+
+  // Assigned elements make it readable, the copy has no eventfd.
+  ConcurrentQueue<int> other;
+  other.Push(3);
+  q = other;
+  REQUIRE(readable());
+  ConcurrentQueue<int> copy(q);
+  REQUIRE(copy.NativeHandle() == -1);
+  q = ConcurrentQueue<int>();
+  REQUIRE(!readable());
+
+  q.SetFinish();
+  REQUIRE(readable());
+}
+
+TEST_CASE("Parallel test for tokens of unlimited size concurrent queue",
+          "<int, UnlimitedSize>(Token)[Parallel]") {
+  const int size = 100000;
+  ConcurrentQueue<int> q;
+  const int nthreadput = 10;
+  const int nthreadget = 10;
+
+  std::vector<std::thread> threads;
+  std::atomic<int> completed_put{0};
+  for (int i = 0; i < nthreadput; i++) {
+    int l = i * size / nthreadput;
+    int r = (i + 1) * size / nthreadput;
+    threads.emplace_back(
+        [&](int l, int r) {
+          // Half of the producers push without token.
+          if (l % 2 == 0) {
+            ConcurrentQueue<int>::ProducerToken token(q);
+            for (int i = l; i < r; i++) {
+              q.Push(token, i);
+            }
+          } else {
+            for (int i = l; i < r; i++) {
+              q.Push(i);
+            }
+          }
+          if (++completed_put == nthreadput) {
+            q.SetFinish();
+          }
+        },
+        l, r);
+  }
+  std::vector<std::vector<int>> collections(nthreadget);
+  for (int i = 0; i < nthreadget; i++) {
+    threads.emplace_back(
+        [&](int id) {
+          int x;
+          if (id % 2 == 0) {
+            ConcurrentQueue<int>::ConsumerToken token(q);
+            while (q.Pop(token, x)) {
+              collections[id].push_back(x);
+            }
+          } else {
+            while (q.Pop(x)) {
+              collections[id].push_back(x);
+            }
+          }
+        },
+        i);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  REQUIRE(q.Size() == 0);
+  std::multiset<int> out;
+  bool ordered = true;
+  for (int i = 0; i < nthreadget; i++) {
+    out.insert(collections[i].begin(), collections[i].end());
+    // Elements of one producer are popped in order.
+    std::vector<int> last(nthreadput, -1);
+    for (int x : collections[i]) {
+      int producer = x / (size / nthreadput);
+      ordered = ordered && x > last[producer];
+      last[producer] = x;
+    }
+  }
+  REQUIRE(ordered);
+  REQUIRE(out.size() == size);
+  REQUIRE(std::set<int>(out.begin(), out.end()).size() == size);
+}
+
+TEST_CASE("Conflating queue keeps the latest value at the first position",
+          "<int, Conflating>") {
+  ConflatingQueue<int, std::string> q;
+  q.Push(1, "a");
+  q.Push(2, "b");
+  q.Push(1, "c");
+  REQUIRE(q.Size() == 2);
+  int key;
+  std::string value;
+  REQUIRE(q.TryPop(key, value));
+  REQUIRE(key == 1);
+  REQUIRE(value == "c");
+  // A popped key is pushed into back again.
+  q.Push(1, "d");
+  // Grow past the initial capacity.
+  for (int i = 100; i < 200; i++) {
+    q.Push(i, std::to_string(i));
+    q.Push(2, std::to_string(i));
+  }
+  REQUIRE(q.Size() == 102);
+  REQUIRE(q.Pop(key, value));
+  REQUIRE(key == 2);
+  REQUIRE(value == "199");
+  REQUIRE(q.Pop(key, value));
+  REQUIRE(key == 1);
+  REQUIRE(value == "d");
+  for (int i = 100; i < 200; i++) {
+    REQUIRE(q.Pop(key, value));
+    REQUIRE(key == i);
+  }
+  q.SetFinish();
+  REQUIRE(!q.Pop(key, value));
+}
+
+TEST_CASE("Parallel test for conflating queue",
+          "<int, Conflating>[Parallel]") {
+  const int nkey = 100;
+  const int nupdate = 10000;
+  ConflatingQueue<int, int> q;
+  const int nthreadput = 4;
+  const int nthreadget = 4;
+
+  std::vector<std::thread> threads;
+  std::atomic<int> completed_put{0};
+  for (int i = 0; i < nthreadput; i++) {
+    threads.emplace_back(
+        [&](int id) {
+          // Each producer owns the keys congruent to `id`, and pushes
+          // increasing values.
+          for (int v = 0; v < nupdate; v++) {
+            for (int key = id; key < nkey; key += nthreadput) {
+              q.Push(key, v);
+            }
+          }
+          if (++completed_put == nthreadput) {
+            q.SetFinish();
+          }
+        },
+        i);
+  }
+  std::vector<std::vector<std::pair<int, int>>> collections(nthreadget);
+  for (int i = 0; i < nthreadget; i++) {
+    threads.emplace_back(
+        [&](int id) {
+          int key, value;
+          while (q.Pop(key, value)) {
+            collections[id].emplace_back(key, value);
+          }
+        },
+        i);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  std::vector<int> latest(nkey, -1);
+  std::size_t total = 0;
+  for (const auto& collection : collections) {
+    total += collection.size();
+    for (const auto& entry : collection) {
+      latest[entry.first] = std::max(latest[entry.first], entry.second);
+    }
+  }
+  // The last update of every key is delivered, stale ones may be dropped.
+  REQUIRE(total <= static_cast<std::size_t>(nkey) * nupdate);
+  REQUIRE(std::count(latest.begin(), latest.end(), nupdate - 1) == nkey);
+}
+
+TEST_CASE("Parallel test for partitioned queue keeps order per key",
+          "<int, Partitioned>[Parallel]") {
+  const int nkey = 64;
+  const int size = 100000;
+  PartitionedQueue<int, std::pair<int, int>> q(8, 4);
+  const int nthreadput = 4;
+  const int nthreadget = 6;
+
+  std::vector<std::thread> threads;
+  std::atomic<int> completed_put{0};
+  for (int i = 0; i < nthreadput; i++) {
+    threads.emplace_back(
+        [&](int id) {
+          // Each producer owns the keys congruent to `id`.
+          for (int seq = 0; seq < size / nkey; seq++) {
+            for (int key = id; key < nkey; key += nthreadput) {
+              q.Push(key, std::make_pair(key, seq));
+            }
+          }
+          if (++completed_put == nthreadput) {
+            q.SetFinish();
+          }
+        },
+        i);
+  }
+  // Only touched by the consumer leasing the lane of the key.
+  std::vector<int> last(nkey, -1);
+  std::atomic<bool> ordered{true};
+  std::atomic<int> popped{0};
+  for (int i = 0; i < nthreadget; i++) {
+    threads.emplace_back([&] {
+      decltype(q)::Lease lease(q);
+      std::pair<int, int> x;
+      while (q.Pop(lease, x)) {
+        if (x.second != last[x.first] + 1) ordered = false;
+        last[x.first] = x.second;
+        ++popped;
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  REQUIRE(ordered);
+  REQUIRE(popped == size / nkey * nkey);
+  REQUIRE(q.Size() == 0);
+}
+
+TEST_CASE("Fair queue serves tenants in proportion to their weights",
+          "<int, Fair>") {
+  FairQueue<std::string, int> q;
+  q.SetWeight("b", 3);
+  for (int i = 0; i < 8; i++) {
+    q.Push("a", i);
+  }
+  for (int i = 0; i < 8; i++) {
+    q.Push("b", 100 + i);
+  }
+  q.Push("c", 200);
+  REQUIRE(q.Size() == 17);
+  REQUIRE(q.Size("b") == 8);
+
+  // One element of "a", three of "b" and one of "c" per round.
+  std::vector<int> expected{0, 100, 101, 102, 200, 1, 103, 104, 105, 2,
+                            106, 107, 3, 4, 5, 6, 7};
+  std::vector<int> popped;
+  int x;
+  while (q.TryPop(x)) {
+    popped.push_back(x);
+  }
+  REQUIRE(popped == expected);
+  q.SetFinish();
+  q.Push("a", 8);
+  REQUIRE(!q.Pop(x));
+}
+
+TEST_CASE("Parallel test for fair queue", "<int, Fair>[Parallel]") {
+  const int ntenant = 16;
+  const int size = 100000;
+  FairQueue<int, int> q;
+  const int nthreadput = 4;
+  const int nthreadget = 4;
+  for (int tenant = 0; tenant < ntenant; tenant++) {
+    q.SetWeight(tenant, tenant % 4 + 1);
+  }
+
+  std::vector<std::thread> threads;
+  std::atomic<int> completed_put{0};
+  for (int i = 0; i < nthreadput; i++) {
+    threads.emplace_back(
+        [&](int id) {
+          for (int j = id; j < size; j += nthreadput) {
+            q.Push(j % ntenant, j);
+          }
+          if (++completed_put == nthreadput) {
+            q.SetFinish();
+          }
+        },
+        i);
+  }
+  std::vector<std::vector<int>> results(nthreadget);
+  for (int i = 0; i < nthreadget; i++) {
+    threads.emplace_back(
+        [&](int id) {
+          int x;
+          while (q.Pop(x)) {
+            results[id].push_back(x);
+          }
+        },
+        i);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  std::set<int> all;
+  for (auto& result : results) {
+    all.insert(result.begin(), result.end());
+  }
+  REQUIRE(all.size() == size);
+  REQUIRE(*all.begin() == 0);
+  REQUIRE(*all.rbegin() == size - 1);
+  REQUIRE(q.Size() == 0);
+}
+
+TEST_CASE("Delay queue pops elements in due order once due",
+          "<int, Delay>") {
+  using Clock = std::chrono::steady_clock;
+  // A nanosecond tick sends delays of milliseconds through every level and
+  // the overflow list.
+  DelayQueue<int> q(std::chrono::nanoseconds(1));
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<int> delay_us(0, 50000);
+  const int size = 1000;
+  std::vector<Clock::time_point> due(size);
+  Clock::time_point start = Clock::now();
+  for (int i = 0; i < size; i++) {
+    due[i] = start + std::chrono::microseconds(delay_us(rng));
+    q.Push(i, due[i]);
+  }
+  REQUIRE(q.Size() == size);
+  q.SetFinish();
+  int x;
+  int popped = 0;
+  bool in_time = true;
+  bool ordered = true;
+  Clock::time_point last = start;
+  while (q.Pop(x)) {
+    in_time = in_time && Clock::now() >= due[x];
+    ordered = ordered && due[x] >= last;
+    last = due[x];
+    ++popped;
+  }
+  REQUIRE(in_time);
+  REQUIRE(ordered);
+  REQUIRE(popped == size);
+}
+
+TEST_CASE("Delay queue wakes up a consumer for an earlier element",
+          "<int, Delay>[Parallel]") {
+  using Clock = std::chrono::steady_clock;
+  DelayQueue<int> q;
+  Clock::time_point start = Clock::now();
+  q.Push(1, start + std::chrono::seconds(10));
+  int x = 0;
+  REQUIRE(!q.TryPop(x));
+  bool suc = false;
+  std::thread consumer([&] { suc = q.Pop(x); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  q.Push(2, Clock::now() + std::chrono::milliseconds(20));
+  consumer.join();
+  REQUIRE(suc);
+  REQUIRE(x == 2);
+  REQUIRE(Clock::now() - start < std::chrono::seconds(5));
+  REQUIRE(q.Size() == 1);
+}
+
+TEST_CASE("CoDel concurrent queue drops elements of a standing backlog",
+          "<int, CoDel>") {
+  const int size = 300;
+  std::vector<int> dropped;
+  CoDelOptions<int> options;
+  options.target = std::chrono::milliseconds(1);
+  options.interval = std::chrono::milliseconds(4);
+  options.on_drop = [&dropped](int&& x) { dropped.push_back(x); };
+  CoDelConcurrentQueue<int> q{CoDelContainer<int>(options)};
+  for (int i = 0; i < size; i++) {
+    q.Push(i);
+  }
+  q.SetFinish();
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  // A slow consumer keeps the sojourn time above target.
+  std::vector<int> popped;
+  int x;
+  while (q.Pop(x)) {
+    popped.push_back(x);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  REQUIRE(!dropped.empty());
+  REQUIRE(popped.size() + dropped.size() == size);
+  // The last element is never dropped.
+  REQUIRE(popped.back() == size - 1);
+  std::vector<int> all(popped);
+  all.insert(all.end(), dropped.begin(), dropped.end());
+  std::sort(all.begin(), all.end());
+  REQUIRE(std::set<int>(all.begin(), all.end()).size() == size);
+}
+
+TEST_CASE("Recycling queue hands released objects back to producers",
+          "<int, Recycling>") {
+  RecyclingQueue<std::vector<int>> q(1);
+  std::unique_ptr<std::vector<int>> item = q.Acquire();
+  std::vector<int>* raw = item.get();
+  item->push_back(1);
+  q.Push(std::move(item));
+  REQUIRE(q.Size() == 1);
+  REQUIRE(q.Pop(item));
+  REQUIRE(item.get() == raw);
+  q.Release(std::move(item));
+  REQUIRE(q.Pooled() == 1);
+  // The pool is full, the second object is freed.
+  q.Release(std::unique_ptr<std::vector<int>>(new std::vector<int>()));
+  REQUIRE(q.Pooled() == 1);
+
+  item = q.Acquire();
+  REQUIRE(item.get() == raw);
+  REQUIRE(*item == std::vector<int>{1});
+  REQUIRE(q.Pooled() == 0);
+  q.SetFinish();
+  q.Push(std::move(item));
+  REQUIRE(!q.TryPop(item));
+
+  // The ring goes round many times without losing objects.
+  RecyclingQueue<int> ring(3);
+  std::vector<std::unique_ptr<int>> objects;
+  std::set<int*> addresses;
+  for (int i = 0; i < 3; i++) {
+    objects.push_back(ring.Acquire());
+    addresses.insert(objects.back().get());
+  }
+  bool recycled = true;
+  for (int round = 0; round < 10; round++) {
+    for (auto& object : objects) {
+      ring.Release(std::move(object));
+    }
+    for (auto& object : objects) {
+      object = ring.Acquire();
+      if (!addresses.count(object.get())) recycled = false;
+    }
+  }
+  REQUIRE(recycled);
+  REQUIRE(ring.Pooled() == 0);
+}
+
+TEST_CASE("Parallel test for recycling queue", "<int, Recycling>[Parallel]") {
+  const int size = 100000;
+  RecyclingQueue<std::vector<int>, 64> q;
+  const int nthreadput = 4;
+  const int nthreadget = 4;
+
+  std::vector<std::thread> threads;
+  std::atomic<int> completed_put{0};
+  // Objects that were not recycled.
+  std::atomic<int> allocated{0};
+  for (int i = 0; i < nthreadput; i++) {
+    threads.emplace_back(
+        [&](int id) {
+          for (int j = id; j < size; j += nthreadput) {
+            std::unique_ptr<std::vector<int>> item = q.Acquire();
+            if (item->empty()) ++allocated;
+            item->assign(1, j);
+            q.Push(std::move(item));
+          }
+          if (++completed_put == nthreadput) {
+            q.SetFinish();
+          }
+        },
+        i);
+  }
+  std::vector<std::vector<int>> results(nthreadget);
+  for (int i = 0; i < nthreadget; i++) {
+    threads.emplace_back(
+        [&](int id) {
+          std::unique_ptr<std::vector<int>> item;
+          while (q.Pop(item)) {
+            results[id].push_back(item->front());
+            q.Release(std::move(item));
+          }
+        },
+        i);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  std::set<int> all;
+  for (auto& result : results) {
+    all.insert(result.begin(), result.end());
+  }
+  REQUIRE(all.size() == size);
+  REQUIRE(q.Size() == 0);
+  REQUIRE(allocated < size / 10);
+}
+
+TEST_CASE("Ordered pipeline keeps the order of the source",
+          "<int, Pipeline>[Parallel]") {
+  const int size = 100000;
+  int next = 0;
+  std::vector<std::string> result;
+  Pipeline()
+      .Source<int>([&](int& x) {
+        x = next++;
+        return x < size;
+      })
+      .ParallelMap([](int&& x) { return x * 2; }, 4)
+      .ParallelMap([](int&& x) { return std::to_string(x); }, 3)
+      .Sink([&](std::string&& x) { result.push_back(std::move(x)); });
+  REQUIRE(result.size() == size);
+  bool ordered = true;
+  for (int i = 0; i < size; i++) {
+    if (result[i] != std::to_string(i * 2)) ordered = false;
+  }
+  REQUIRE(ordered);
+}
+
+TEST_CASE("Unordered pipeline passes every element on",
+          "<int, Pipeline>[Parallel]") {
+  const int size = 100000;
+  int next = 0;
+  std::multiset<int> result;
+  Pipeline()
+      .Source<int>([&](int& x) {
+        x = next++;
+        return x < size;
+      })
+      .ParallelMap([](int&& x) { return x + 1; }, 4, false)
+      .ParallelMap([](int&& x) { return x - 1; }, 2)
+      .Sink([&](int&& x) { result.insert(x); });
+  REQUIRE(result.size() == size);
+  REQUIRE(std::set<int>(result.begin(), result.end()).size() == size);
+  REQUIRE(*result.begin() == 0);
+  REQUIRE(*result.rbegin() == size - 1);
+}
+
+TEST_CASE("Every consumer group of broadcast queue sees every element",
+          "<int, Broadcast>") {
+  BroadcastQueue<std::string, 4> q;
+  std::size_t a = q.AddConsumerGroup();
+  std::size_t b = q.AddConsumerGroup();
+  q.Push("1");
+  q.Push("2");
+  REQUIRE(q.Size(a) == 2);
+  std::string s;
+  REQUIRE(q.Pop(a, s));
+  REQUIRE(s == "1");
+  REQUIRE(q.Pop(a, s));
+  REQUIRE(s == "2");
+  REQUIRE(!q.TryPop(a, s));
+  // Group b has not passed the elements, so they are kept.
+  REQUIRE(q.Size() == 2);
+  REQUIRE(q.Pop(b, s));
+  REQUIRE(s == "1");
+  REQUIRE(q.Size() == 1);
+  q.SetFinish();
+  REQUIRE(q.Pop(b, s));
+  REQUIRE(s == "2");
+  REQUIRE(!q.Pop(b, s));
+  REQUIRE(!q.Pop(a, s));
+}
+
+TEST_CASE("Parallel test for broadcast queue", "<int, Broadcast>[Parallel]") {
+  const int size = 100000;
+  BroadcastQueue<int, 16> q;
+  const int ngroup = 3;
+  const int nthreadput = 2;
+  const int nthreadget = 2;
+  std::vector<std::size_t> groups;
+  for (int i = 0; i < ngroup; i++) {
+    groups.push_back(q.AddConsumerGroup());
+  }
+
+  std::vector<std::thread> threads;
+  std::atomic<int> completed_put{0};
+  for (int i = 0; i < nthreadput; i++) {
+    int l = i * size / nthreadput;
+    int r = (i + 1) * size / nthreadput;
+    threads.emplace_back(
+        [&](int l, int r) {
+          for (int i = l; i < r; i++) {
+            q.Push(i);
+          }
+          if (++completed_put == nthreadput) {
+            q.SetFinish();
+          }
+        },
+        l, r);
+  }
+  std::vector<std::vector<int>> collections(ngroup * nthreadget);
+  for (int g = 0; g < ngroup; g++) {
+    for (int i = 0; i < nthreadget; i++) {
+      threads.emplace_back(
+          [&](std::size_t group, int id) {
+            int x;
+            while (q.Pop(group, x)) {
+              collections[id].push_back(x);
+            }
+          },
+          groups[g], g * nthreadget + i);
+    }
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (int g = 0; g < ngroup; g++) {
+    std::multiset<int> out;
+    for (int i = 0; i < nthreadget; i++) {
+      auto& collection = collections[g * nthreadget + i];
+      out.insert(collection.begin(), collection.end());
+    }
+    REQUIRE(out.size() == size);
+    REQUIRE(std::set<int>(out.begin(), out.end()).size() == size);
+  }
+}
+
+TEST_CASE(
+    "MoveOnlyStruct in lock-free concurrent queue destruct at the right time",
+    "<MoveOnlyStruct, LockFree>") {
+  destrct_cnt = 0;
+  {
+    LockFreeConcurrentQueue<MoveOnlyStruct> c;
+    // Cross a few segments.
+    for (int i = 0; i < 3000; i++) {
+      c.Push(MoveOnlyStruct(i));
+    }
+    REQUIRE(destrct_cnt == 0);
+    REQUIRE(c.Size() == 3000);
+    for (int i = 0; i < 2000; i++) {
+      MoveOnlyStruct tmp(-1);
+      REQUIRE(c.TryPop(tmp));
+      REQUIRE(*tmp.value == i);
+    }
+    REQUIRE(destrct_cnt == 2000);
+    REQUIRE(c.Size() == 1000);
+    REQUIRE(c.TryPop());
+    REQUIRE(c.Pop());
+    REQUIRE(destrct_cnt == 2002);
+    REQUIRE(c.Size() == 998);
+  }
+  REQUIRE(destrct_cnt == 3000);
+}
+
+TEST_CASE("Medium parallel test for lock-free concurrent queue",
+          "<int, LockFree>[Parallel]") {
+  const int size = 100000;
+  LockFreeConcurrentQueue<int> q;
+  const int nthreadput = 10;
+  const int nthreadget = 10;
+
+  std::vector<std::thread> threads;
+  std::atomic<int> completed_put{0};
+  for (int i = 0; i < nthreadput; i++) {
+    int l = i * size / nthreadput;
+    int r = (i + 1) * size / nthreadput;
+    threads.emplace_back(
+        [&](int l, int r) {
+          for (int i = l; i < r; i++) {
+            q.Push(i);
+          }
+          if (++completed_put == nthreadput) {
+            q.SetFinish();
+          }
+        },
+        l, r);
+  }
+  std::vector<std::vector<int>> collections(nthreadget);
+  for (int i = 0; i < nthreadget; i++) {
+    threads.emplace_back(
+        [&](int id) {
+          int x;
+          while (q.Pop(x)) {
+            collections[id].push_back(x);
+          }
+        },
+        i);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  std::multiset<int> out;
+  bool ordered = true;
+  for (int i = 0; i < nthreadget; i++) {
+    out.insert(collections[i].begin(), collections[i].end());
+    // Elements of one producer are popped in order.
+    std::vector<int> last(nthreadput, -1);
+    for (int x : collections[i]) {
+      int producer = x / (size / nthreadput);
+      ordered = ordered && x > last[producer];
+      last[producer] = x;
+    }
+  }
+  REQUIRE(ordered);
+  REQUIRE(out.size() == size);
+  REQUIRE(std::set<int>(out.begin(), out.end()).size() == size);
+}
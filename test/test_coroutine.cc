@@ -0,0 +1,165 @@
+/**
+ * @author Hanwen Zheng
+ * @email eserinc.z@outlook.com
+ * @create date 2026-10-19 09:20:14
+ * @modify date 2026-10-19 09:20:14
+ * @desc Tests for coroutine operations of concurrent queue. This source file
+ * is supposed to be compile with '-std=c++20'.
+ */
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "../concurrent_queue.h"
+#define CATCH_CONFIG_MAIN
+#include "../third_party/catch.hpp"
+
+#ifndef FOX_CQ_HAS_COROUTINE
+#error "These tests require C++20 coroutines."
+#endif
+
+using namespace fox_cq;
+
+// A coroutine started eagerly and destroyed when it finishes.
+struct Task {
+  struct promise_type {
+    Task get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+template <typename Queue>
+Task PopOnce(Queue& q, int& value, std::optional<bool>& result) {
+  result = co_await q.AsyncPop(value);
+}
+
+template <typename Queue>
+Task PushOnce(Queue& q, int value, std::optional<bool>& result) {
+  result = co_await q.AsyncPush(value);
+}
+
+TEST_CASE("AsyncPop and AsyncPush complete without suspending",
+          "<int, Coroutine>") {
+  ConcurrentQueue<int, 2> q;
+  std::optional<bool> pushed, popped;
+  PushOnce(q, 1, pushed);
+  REQUIRE(pushed == true);
+  int x = 0;
+  PopOnce(q, x, popped);
+  REQUIRE(popped == true);
+  REQUIRE(x == 1);
+  REQUIRE(q.Size() == 0);
+}
+
+TEST_CASE("SetFinish resumes a suspended AsyncPop with false",
+          "<int, Coroutine>") {
+  ConcurrentQueue<int> q;
+  int x = 0;
+  std::optional<bool> popped;
+  PopOnce(q, x, popped);
+  REQUIRE(!popped);
+  q.SetFinish();
+  REQUIRE(popped == false);
+}
+
+TEST_CASE("SetFinish resumes a suspended AsyncPush with false",
+          "<int, Coroutine>") {
+  ConcurrentQueue<int, 1> q;
+  q.Push(1);
+  std::optional<bool> pushed;
+  PushOnce(q, 2, pushed);
+  REQUIRE(!pushed);
+  q.SetFinish();
+  REQUIRE(pushed == false);
+  // The item of the finished push is discarded.
+  int x;
+  REQUIRE(q.Pop(x));
+  REQUIRE(x == 1);
+  REQUIRE(!q.Pop(x));
+}
+
+TEST_CASE("Push and Pop hand over to suspended coroutines",
+          "<int, Coroutine>") {
+  ConcurrentQueue<int, 1> q;
+  int x = 0;
+  std::optional<bool> popped;
+  PopOnce(q, x, popped);
+  q.Push(3);
+  REQUIRE(popped == true);
+  REQUIRE(x == 3);
+
+  q.Push(4);
+  std::optional<bool> pushed;
+  PushOnce(q, 5, pushed);
+  REQUIRE(!pushed);
+  REQUIRE(q.Pop(x));
+  REQUIRE(x == 4);
+  // The free slot went to the suspended push.
+  REQUIRE(pushed == true);
+  REQUIRE(q.Pop(x));
+  REQUIRE(x == 5);
+}
+
+TEST_CASE("Coroutines are resumed through the executor", "<int, Coroutine>") {
+  ConcurrentQueue<int> q;
+  std::vector<std::coroutine_handle<>> ready;
+  q.SetCoroutineExecutor(
+      [&ready](std::coroutine_handle<> handle) { ready.push_back(handle); });
+  int x = 0, y = 0;
+  std::optional<bool> first, second;
+  PopOnce(q, x, first);
+  PopOnce(q, y, second);
+  q.Push(6);
+  // Handed the element, but not resumed inline.
+  REQUIRE(ready.size() == 1);
+  REQUIRE(!first);
+  ready[0].resume();
+  REQUIRE(first == true);
+  REQUIRE(x == 6);
+
+  q.SetFinish();
+  REQUIRE(ready.size() == 2);
+  REQUIRE(!second);
+  ready[1].resume();
+  REQUIRE(second == false);
+}
+
+TEST_CASE("Token push wakes up a suspended AsyncPop", "<int, Coroutine>") {
+  ConcurrentQueue<int> q;
+  int x = 0;
+  std::optional<bool> popped;
+  PopOnce(q, x, popped);
+  ConcurrentQueue<int>::ProducerToken token(q);
+  q.Push(token, 7);
+  REQUIRE(popped == true);
+  REQUIRE(x == 7);
+}
+
+TEST_CASE("Token push from another thread wakes up suspended AsyncPop",
+          "<int, Coroutine>[Parallel]") {
+  const int size = 1000;
+  ConcurrentQueue<int> q;
+  std::vector<int> values(size, -1);
+  std::vector<std::optional<bool>> results(size);
+  for (int i = 0; i < size; i++) {
+    PopOnce(q, values[i], results[i]);
+  }
+  std::thread producer([&q] {
+    ConcurrentQueue<int>::ProducerToken token(q);
+    for (int i = 0; i < size; i++) {
+      q.Push(token, i);
+    }
+  });
+  producer.join();
+  // Coroutines are resumed inline by the producer, in the order they waited.
+  for (int i = 0; i < size; i++) {
+    REQUIRE(results[i] == true);
+    REQUIRE(values[i] == i);
+  }
+  REQUIRE(q.Size() == 0);
+}